@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/** Bump allocator owning the objects of a cloth or mesh, all freed at once **/
+// Objects are placed back to back in large chunks, so building a mesh costs a few allocations instead of one per
+// node, spring or vertex, and tearing it down frees the chunks without visiting the objects. Only types with a
+// non-trivial destructor are remembered and destroyed, in reverse order of creation. Nothing is freed one by one.
+struct Arena
+{
+    struct Chunk
+    {
+        char* data;
+        size_t size;
+        size_t used;
+    };
+    struct Destructor
+    {
+        void (*destroy)(void*);
+        void* object;
+    };
+
+    std::vector<Chunk> chunks;
+    std::vector<Destructor> destructors;
+    size_t chunkSize;   // Of chunks opened without a reserve
+    size_t reserved;    // Size of the next chunk, see reserve()
+
+    Arena(size_t size = 64 * 1024)
+    {
+        chunkSize = size;
+        reserved = 0;
+    }
+    ~Arena() { clear(); }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /** Makes the next chunk hold at least bytes, call before a known number of creates **/
+    void reserve(size_t bytes)
+    {
+        if (!chunks.empty() && chunks.back().size - chunks.back().used >= bytes) return;
+        reserved = std::max(reserved, bytes);
+    }
+
+    void* allocate(size_t bytes, size_t align)
+    {
+        if (!chunks.empty()) {
+            Chunk& chunk = chunks.back();
+            size_t start = alignUp(chunk.data, chunk.used, align);
+            if (start + bytes <= chunk.size) {
+                chunk.used = start + bytes;
+                return chunk.data + start;
+            }
+        }
+        Chunk chunk;
+        chunk.size = std::max(std::max(chunkSize, reserved), bytes) + align;
+        chunk.data = (char*)::operator new(chunk.size);
+        size_t start = alignUp(chunk.data, 0, align);
+        chunk.used = start + bytes;
+        chunks.push_back(chunk);
+        reserved = 0;
+        return chunk.data + start;
+    }
+
+    template <typename T, typename... Args>
+    T* create(Args&&... args)
+    {
+        T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value) {
+            Destructor d = { &destroy<T>, object };
+            destructors.push_back(d);
+        }
+        return object;
+    }
+
+    /** Uninitialized room for count objects, constructed in place by the caller, from any thread **/
+    template <typename T>
+    T* allocateArray(size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena arrays are never destroyed");
+        return (T*)allocate(sizeof(T) * count, alignof(T));
+    }
+
+    /** Destroys every object and frees every chunk, pointers handed out before are dangling afterwards **/
+    void clear()
+    {
+        for (int i = (int)destructors.size() - 1; i >= 0; i --) { destructors[i].destroy(destructors[i].object); }
+        for (int i = 0; i < chunks.size(); i ++) { ::operator delete(chunks[i].data); }
+        destructors.clear();
+        chunks.clear();
+        reserved = 0;
+    }
+
+    size_t bytesUsed() const
+    {
+        size_t total = 0;
+        for (int i = 0; i < chunks.size(); i ++) { total += chunks[i].used; }
+        return total;
+    }
+
+    template <typename T>
+    static void destroy(void* object) { ((T*)object)->~T(); }
+
+    static size_t alignUp(const char* base, size_t offset, size_t align)
+    {
+        uintptr_t address = (uintptr_t)(base + offset);
+        return offset + (size_t)((align - address % align) % align);
+    }
+};
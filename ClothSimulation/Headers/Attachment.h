@@ -0,0 +1,256 @@
+#pragma once
+
+#include <math.h>
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <vector>
+
+#include "Log.h"
+#include "Parallel.h"
+#include "Points.h"
+
+/** Long-range attachments (Kim et al. 2012): no node gets farther from its nearest pin than it is along the cloth **/
+// A hanging cloth stretches most far from its pins, where the weight of everything below adds up along a chain of
+// springs, and stiffer springs need more substeps. Instead every node keeps the rest geodesic distance to its
+// nearest pin, and after integration a node beyond it is put back on that sphere and loses its outward velocity.
+// Each node only reads its own state and a pinned node, which never moves during a substep, so the pass is one
+// parallel loop. Distances are shortest paths in a graph of rest lengths: the edges of the faces, plus the
+// diagonal across every convex pair of faces, which brings grid paths within a few percent of the straight line.
+// Pinning adds a source, a pruned Dijkstra from it; unpinning re-solves only the nodes the pin was nearest to, and
+// a torn face drops its edges and re-solves only the nodes whose shortest path crossed one of them.
+template <typename T>
+struct LongRangeAttachmentT
+{
+    typedef Vec3T<T> Vec3;
+    typedef NodeT<T> Node;
+
+    double stretch = 1.0;           // Allowed fraction of the rest geodesic distance
+
+    /** Rest graph in compressed rows **/
+    std::vector<int> edgeStart;
+    std::vector<int> edgeNodes;
+    std::vector<T> edgeLength;
+
+    /** Node pairs behind the rows, for tearing **/
+    std::vector<int> pairNodes;     // Two per pair
+    std::vector<int> pairSlots;     // Two per pair, its entry in the row of each end
+    std::vector<int> pairFaces;     // Faces left to remove before the pair drops: those on an edge, 1 for a diagonal
+    std::vector<int> facePairs;     // Six per face, its three edges and the diagonals across them, -1 for none
+
+    std::vector<T> distance;        // Rest geodesic distance to the nearest pin, INFINITY for none
+    std::vector<int> anchor;        // That pin, -1 for none
+    std::vector<int> parent;        // Previous node on the shortest path, -1 for pins and unattached nodes
+    std::vector<int> broken;        // Nodes whose path to the pin crossed a dropped pair, see repair()
+
+    typedef std::pair<T, int> Entry;
+    typedef std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > Queue;
+
+    bool active() const { return !edgeStart.empty(); }
+
+    /** Edges as two node indices and two faces (-1 for none) each, pairs of faces as four nodes (edge ends, then the
+        vertices opposite the edge) and two faces **/
+    void build(const std::vector<Vec3>& rest, const std::vector<int>& edges, const std::vector<int>& edgeFaces,
+               const std::vector<int>& hinges, const std::vector<int>& hingeFaces, int faceCount, const std::vector<Node*>& nodes)
+    {
+        pairNodes = edges;
+        facePairs.assign(6 * faceCount, -1);
+        pairFaces.clear();
+        for (int p = 0; p < edges.size() / 2; p ++) {
+            pairFaces.push_back((edgeFaces[2*p] >= 0) + (edgeFaces[2*p+1] >= 0));
+            for (int k = 0; k < 2; k ++) { addFacePair(edgeFaces[2*p+k], p); }
+        }
+        for (int h = 0; h < hinges.size() / 4; h ++) {
+            const int* n = &hinges[4*h];
+            if (!crosses(rest[n[0]], rest[n[1]], rest[n[2]], rest[n[3]])) continue;
+            int p = (int)pairNodes.size() / 2;
+            pairNodes.push_back(n[2]);
+            pairNodes.push_back(n[3]);
+            pairFaces.push_back(1); // Crosses both faces, either one torn cuts it
+            for (int k = 0; k < 2; k ++) { addFacePair(hingeFaces[2*h+k], p); }
+        }
+        int count = (int)rest.size();
+        edgeStart.assign(count + 1, 0);
+        for (int i = 0; i < pairNodes.size(); i ++) { edgeStart[pairNodes[i] + 1] ++; }
+        for (int i = 0; i < count; i ++) { edgeStart[i + 1] += edgeStart[i]; }
+        edgeNodes.resize(pairNodes.size());
+        edgeLength.resize(pairNodes.size());
+        pairSlots.resize(pairNodes.size());
+        std::vector<int> fill(edgeStart.begin(), edgeStart.end() - 1);
+        for (int i = 0; i < pairNodes.size(); i += 2) {
+            int a = pairNodes[i], b = pairNodes[i+1];
+            T len = (rest[a] - rest[b]).length();
+            pairSlots[i] = fill[a];
+            edgeNodes[fill[a]] = b;
+            edgeLength[fill[a] ++] = len;
+            pairSlots[i+1] = fill[b];
+            edgeNodes[fill[b]] = a;
+            edgeLength[fill[b] ++] = len;
+        }
+        broken.clear();
+        recompute(nodes);
+    }
+
+    void addFacePair(int f, int p)
+    {
+        if (f < 0) return;
+        int* slot = &facePairs[6*f];
+        while (*slot >= 0) { slot ++; }
+        *slot = p;
+    }
+
+    /** Whether segment cd crosses segment ab, in the rest plane: the pair of faces is convex across ab **/
+    static bool crosses(const Vec3& a, const Vec3& b, const Vec3& c, const Vec3& d)
+    {
+        auto side = [](const Vec3& p, const Vec3& q, const Vec3& r) { return (q.x - p.x) * (r.y - p.y) - (q.y - p.y) * (r.x - p.x); };
+        return side(a, b, c) * side(a, b, d) < 0 && side(c, d, a) * side(c, d, b) < 0;
+    }
+
+    /** Every pinned node as a source **/
+    void recompute(const std::vector<Node*>& nodes)
+    {
+        distance.assign(nodes.size(), INFINITY);
+        anchor.assign(nodes.size(), -1);
+        parent.assign(nodes.size(), -1);
+        Queue queue;
+        for (int i = 0; i < nodes.size(); i ++) {
+            if (!nodes[i]->isFixed) continue;
+            distance[i] = 0;
+            anchor[i] = i;
+            queue.push(Entry(0, i));
+        }
+        run(queue);
+        int reached = 0;
+        for (int i = 0; i < nodes.size(); i ++) { reached += anchor[i] >= 0; }
+        LOG_DEBUG("Long-range attachments: %d of %d nodes attached\n", reached, (int)nodes.size());
+    }
+
+    /** A new pin only takes the nodes it is nearer to **/
+    void addAnchor(int a)
+    {
+        if (!active() || distance[a] == 0) return;
+        distance[a] = 0;
+        anchor[a] = a;
+        parent[a] = -1;
+        Queue queue;
+        queue.push(Entry(0, a));
+        run(queue);
+    }
+
+    /** The nodes of a released pin go to the next nearest, searched from the border of its region **/
+    void removeAnchor(int a)
+    {
+        if (!active() || anchor[a] != a) return;
+        std::vector<int> region;
+        for (int i = 0; i < anchor.size(); i ++) {
+            if (anchor[i] != a) continue;
+            region.push_back(i);
+            detach(i);
+        }
+        resolve(region);
+    }
+
+    /** Drops the pairs that needed face f, the nodes past them are re-solved together by repair() **/
+    void removeFace(int f)
+    {
+        if (!active()) return;
+        for (int k = 0; k < 6; k ++) {
+            int p = facePairs[6*f+k];
+            if (p < 0 || pairFaces[p] == 0 || -- pairFaces[p] > 0) continue;
+            edgeLength[pairSlots[2*p]] = INFINITY;
+            edgeLength[pairSlots[2*p+1]] = INFINITY;
+            int a = pairNodes[2*p], b = pairNodes[2*p+1];
+            if (parent[b] == a) broken.push_back(b);
+            if (parent[a] == b) broken.push_back(a);
+        }
+    }
+
+    /** Nodes whose shortest path went through a dropped pair, and the nodes after them, are solved again **/
+    // Every other node keeps a path that still exists and distances only grow, so it stays shortest.
+    void repair()
+    {
+        if (broken.empty()) return;
+        std::vector<int> region;
+        for (int k = 0; k < broken.size(); k ++) {
+            if (anchor[broken[k]] < 0) continue;
+            region.push_back(broken[k]);
+            detach(broken[k]);
+        }
+        broken.clear();
+        for (int k = 0; k < region.size(); k ++) { // Down the shortest path tree
+            int i = region[k];
+            for (int e = edgeStart[i]; e < edgeStart[i + 1]; e ++) {
+                int j = edgeNodes[e];
+                if (anchor[j] < 0 || parent[j] != i) continue;
+                region.push_back(j);
+                detach(j);
+            }
+        }
+        resolve(region);
+    }
+
+    void detach(int i)
+    {
+        distance[i] = INFINITY;
+        anchor[i] = -1;
+    }
+
+    /** Detached nodes take the best attached neighbour, then Dijkstra fills the region from there **/
+    void resolve(const std::vector<int>& region)
+    {
+        Queue queue;
+        for (int k = 0; k < region.size(); k ++) {
+            int i = region[k];
+            parent[i] = -1;
+            for (int e = edgeStart[i]; e < edgeStart[i + 1]; e ++) {
+                int j = edgeNodes[e];
+                T d = distance[j] + edgeLength[e];
+                if (anchor[j] >= 0 && d < distance[i]) {
+                    distance[i] = d;
+                    anchor[i] = anchor[j];
+                    parent[i] = j;
+                }
+            }
+            if (anchor[i] >= 0) queue.push(Entry(distance[i], i));
+        }
+        run(queue);
+    }
+
+    /** Dijkstra from the queued nodes, a node only changes when it gets nearer **/
+    void run(Queue& queue)
+    {
+        while (!queue.empty()) {
+            Entry top = queue.top();
+            queue.pop();
+            int i = top.second;
+            if (top.first > distance[i]) continue; // Stale entry
+            for (int e = edgeStart[i]; e < edgeStart[i + 1]; e ++) {
+                int j = edgeNodes[e];
+                T d = distance[i] + edgeLength[e];
+                if (d >= distance[j]) continue;
+                distance[j] = d;
+                anchor[j] = anchor[i];
+                parent[j] = i;
+                queue.push(Entry(d, j));
+            }
+        }
+    }
+
+    /** After node i moved: back within stretch times its geodesic distance of its pin **/
+    void constrain(const std::vector<Node*>& nodes, int i)
+    {
+        int a = anchor[i];
+        Node* node = nodes[i];
+        if (a < 0 || node->isFixed) return;
+        Vec3 d = node->position - nodes[a]->position;
+        T limit = stretch * distance[i];
+        T len2 = Vec3::dot(d, d);
+        if (len2 <= limit * limit) return;
+        Vec3 dir = d / sqrt(len2);
+        node->position = nodes[a]->position;
+        node->position.axpy(limit, dir);
+        T outward = Vec3::dot(node->velocity, dir);
+        if (outward > 0) node->velocity.axpy(-outward, dir);
+    }
+};
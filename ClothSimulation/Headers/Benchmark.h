@@ -0,0 +1,764 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Cloth.h"
+#include "Rigid.h"
+#include "Display.h"
+#include "Ensemble.h"
+#include "Multires.h"
+#include "Parallel.h"
+#include "Simulation.h"
+#include "Json.h"
+
+/** Micro benchmarks of the simulation kernels, in the spirit of Google Benchmark **/
+// Run with: ClothSimulation --benchmark [--benchmark_filter=Spring] [--benchmark_sizes=10,100,1000]
+//                                       [--benchmark_threads=1,4] [--benchmark_min_time=0.5] [--benchmark_out=bench.json]
+//                                       [--benchmark_repetitions=5] [--benchmark_order=grid|morton|hilbert]
+// Regression gate:  ClothSimulation --benchmark_gate [--benchmark_threshold=0.1]
+//                   runs the fixed gate set and compares against Baselines/<scene>-<machine class>.json,
+//                   --benchmark_record writes that file from the same set.
+// Offline compare:  ClothSimulation --benchmark_compare=baseline.json --benchmark_in=current.json
+// Node orders:      run once per --benchmark_order with --benchmark_out, then compare the files, cache misses included.
+
+/** Hardware cache misses of this process and the threads it starts after open(), Linux perf events only **/
+struct CacheMissCounter
+{
+    int fd = -1; // -1 when no counter is available
+    
+    void open()
+    {
+#if defined(__linux__)
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.inherit = 1;        // Thread pool workers count too
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+    void close()
+    {
+#if defined(__linux__)
+        if (fd >= 0) ::close(fd);
+#endif
+        fd = -1;
+    }
+    
+    bool available() const { return fd >= 0; }
+    void reset()
+    {
+#if defined(__linux__)
+        if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+#endif
+    }
+    void enable()
+    {
+#if defined(__linux__)
+        if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+    void disable()
+    {
+#if defined(__linux__)
+        if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+    }
+    long long read()
+    {
+        long long count = -1;
+#if defined(__linux__)
+        if (fd >= 0 && ::read(fd, &count, sizeof(count)) != sizeof(count)) count = -1;
+#endif
+        return count;
+    }
+};
+
+struct BenchmarkState
+{
+    int nodesPerSide;   // Cloth is nodesPerSide x nodesPerSide nodes
+    Cloth::NodeOrderEnum order;
+    int threads;
+    long long maxIterations;
+    long long iterations;
+    long long itemsProcessed;
+
+    double realTime;    // Seconds spent in the timed region
+    double cpuTime;     // Process CPU seconds (all threads) spent in the timed region
+    std::chrono::steady_clock::time_point realStart;
+    std::clock_t cpuStart;
+    CacheMissCounter* cacheMisses; // Counts the timed region only, may be NULL
+
+    BenchmarkState(int n, int t, long long iterationCount)
+    {
+        nodesPerSide = n;
+        order = Cloth::ORDER_GRID;
+        threads = t;
+        maxIterations = iterationCount;
+        iterations = 0;
+        itemsProcessed = 0;
+        realTime = 0.0;
+        cpuTime = 0.0;
+        cacheMisses = NULL;
+    }
+
+    // Usage: while (state.keepRunning()) { kernel(); }
+    bool keepRunning()
+    {
+        if (iterations == 0) resumeTiming();
+        if (iterations == maxIterations) {
+            pauseTiming();
+            return false;
+        }
+        iterations ++;
+        return true;
+    }
+
+    void pauseTiming()
+    {
+        if (cacheMisses) cacheMisses->disable();
+        realTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - realStart).count();
+        cpuTime += (double)(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+    }
+    void resumeTiming()
+    {
+        realStart = std::chrono::steady_clock::now();
+        cpuStart = std::clock();
+        if (cacheMisses) cacheMisses->enable();
+    }
+};
+
+typedef void (*BenchmarkFunction)(BenchmarkState&);
+
+struct Benchmark
+{
+    std::string name;
+    BenchmarkFunction function;
+    bool scalable; // Takes the cloth size and thread count arguments
+};
+
+struct BenchmarkResult
+{
+    std::string name;
+    int nodesPerSide;
+    int threads;
+    long long iterations;
+    double realTime; // Nanoseconds per iteration, mean of the repetitions kept
+    double cpuTime;  // Nanoseconds per iteration, mean of the repetitions kept
+    double stddev;   // Of realTime over the repetitions kept
+    double itemsPerSecond;
+    double cacheMisses; // Per iteration, negative when no counter is available
+    int repetitions;
+    int rejected;    // Repetitions dropped as outliers
+};
+
+/** Scene shared by the cloth kernels: a 10x10 cloth hanging over a ball, its lower rows under the ground **/
+struct BenchmarkScene
+{
+    static const char* name() { return "hanging-over-ball"; }
+    
+    Cloth cloth;
+    Ground ground;
+    Ball ball;
+    Simulation simulation;
+
+    BenchmarkScene(int nodesPerSide, Cloth::NodeOrderEnum order)
+    : cloth(Vec3(-5, 8, -1), Vec2(10, 10), nodesPerSide/10),
+      ground(Vec3(-5, 0, 5), Vec2(10, 10), glm::vec4(0.8, 0.8, 0.8, 1.0)),
+      ball(Vec3(0, 3, -1), 2, glm::vec4(0.6f, 0.5f, 0.8f, 1.0f)),
+      simulation(&cloth, &ground, &ball, 0.01)
+    {
+        cloth.reorder(order);
+        cloth.computeNormal();
+    }
+};
+
+/** Kernels **/
+void BM_SpringForce(BenchmarkState& state) // Spring::applyInternalForce over the whole spring set
+{
+    BenchmarkScene scene(state.nodesPerSide, state.order);
+    while (state.keepRunning()) {
+        scene.cloth.applySpringForces(0.01);
+    }
+    state.itemsProcessed = state.iterations * scene.cloth.springs.size();
+}
+
+void BM_IsometricBending(BenchmarkState& state) // The bending matrix times the packed state, against BM_SpringForce
+{
+    BenchmarkScene scene(state.nodesPerSide, state.order);
+    scene.cloth.useIsometricBending(scene.cloth.isometricBendingCoef, scene.cloth.isometricBendingDamp);
+    while (state.keepRunning()) {
+        scene.cloth.isometric.apply(scene.cloth.nodes);
+    }
+    state.itemsProcessed = state.iterations * scene.cloth.isometric.hingeCount();
+}
+
+void BM_MembraneForce(BenchmarkState& state) // Co-rotated triangle membrane, replacing the structural and shear springs
+{
+    BenchmarkScene scene(state.nodesPerSide, state.order);
+    scene.cloth.useMembrane(Cloth::STRETCH_COROTATED, scene.cloth.membraneYoung, scene.cloth.membranePoisson, scene.cloth.membraneDamp);
+    while (state.keepRunning()) {
+        scene.cloth.membrane.apply(scene.cloth.nodes);
+    }
+    state.itemsProcessed = state.iterations * scene.cloth.membrane.elementCount();
+}
+
+void BM_NodeIntegrate(BenchmarkState& state)
+{
+    BenchmarkScene scene(state.nodesPerSide, state.order);
+    while (state.keepRunning()) {
+        scene.cloth.integrate(0.01);
+    }
+    state.itemsProcessed = state.iterations * scene.cloth.nodes.size();
+}
+
+void BM_ComputeNormal(BenchmarkState& state)
+{
+    BenchmarkScene scene(state.nodesPerSide, state.order);
+    while (state.keepRunning()) {
+        scene.cloth.computeNormal();
+    }
+    state.itemsProcessed = state.iterations * scene.cloth.faces.size()/3;
+}
+
+void BM_CollisionResponse(BenchmarkState& state)
+{
+    BenchmarkScene scene(state.nodesPerSide, state.order);
+    while (state.keepRunning()) {
+        scene.cloth.collisionResponse(&scene.ground, &scene.ball);
+    }
+    state.itemsProcessed = state.iterations * scene.cloth.nodes.size();
+}
+
+void BM_Substep(BenchmarkState& state) // One iteration of the substep loop in main.cpp
+{
+    BenchmarkScene scene(state.nodesPerSide, state.order);
+    while (state.keepRunning()) {
+        scene.simulation.substep();
+    }
+    state.itemsProcessed = state.iterations * scene.cloth.nodes.size();
+}
+
+void BM_BlockedSubstep(BenchmarkState& state) // Same substep, force to collision fused per block
+{
+    BenchmarkScene scene(state.nodesPerSide, state.order);
+    scene.simulation.blocked = true;
+    while (state.keepRunning()) {
+        scene.simulation.substep();
+    }
+    state.itemsProcessed = state.iterations * scene.cloth.nodes.size();
+}
+
+void BM_AeroSubstep(BenchmarkState& state) // Substep with drag and lift against a gusty wind
+{
+    BenchmarkScene scene(state.nodesPerSide, state.order);
+    scene.simulation.aerodynamics = true;
+    scene.simulation.windField.gust = 2.0;
+    scene.simulation.wind = Vec3T<double>(2.0, 0.0, -6.0);
+    scene.cloth.sampleWind(scene.simulation.windField, scene.simulation.wind, 0.0);
+    while (state.keepRunning()) {
+        scene.simulation.substep();
+    }
+    state.itemsProcessed = state.iterations * scene.cloth.nodes.size();
+}
+
+void BM_EnsembleSubstep(BenchmarkState& state) // Substep of 16 instances with swept stiffness, items are nodes of all instances
+{
+    BenchmarkScene scene(state.nodesPerSide, state.order);
+    ClothEnsemble ensemble(scene.cloth, 16, &scene.ground, &scene.ball, 0.01);
+    for (int i = 0; i < ensemble.instanceCount; i ++) {
+        EnsembleInstance instance;
+        instance.structuralCoef = 500.0 + 100.0 * i;
+        ensemble.setInstance(i, instance);
+    }
+    while (state.keepRunning()) {
+        ensemble.substep();
+    }
+    state.itemsProcessed = state.iterations * ensemble.nodeCount * ensemble.instanceCount;
+}
+
+void BM_MultiresUpdate(BenchmarkState& state) // Subdivision, wrinkles and normals of a render cloth up to 4x denser per side
+{
+    BenchmarkScene scene(state.nodesPerSide, state.order);
+    MultiresCloth multires(&scene.simulation, std::max(1, std::min(4, 1200 / state.nodesPerSide)), state.order);
+    while (state.keepRunning()) {
+        multires.update();
+    }
+    state.itemsProcessed = state.iterations * multires.fine.nodes.size();
+}
+
+void BM_ClothStaging(BenchmarkState& state) // CPU side of ClothRender::flush
+{
+    BenchmarkScene scene(state.nodesPerSide, state.order);
+    int count = (int)scene.cloth.nodes.size();
+    std::vector<glm::vec3> pos(count), nor(count);
+    while (state.keepRunning()) {
+        ClothRender::stage(&scene.cloth, &pos[0], &nor[0], count);
+    }
+    state.itemsProcessed = state.iterations * count;
+}
+
+void BM_SphereInit(BenchmarkState& state)
+{
+    long long vertexCount = 0;
+    while (state.keepRunning()) {
+        Sphere sphere(1);
+        vertexCount = sphere.vertexes.size();
+    }
+    state.itemsProcessed = state.iterations * vertexCount;
+}
+
+void BM_SphereNormal(BenchmarkState& state)
+{
+    Sphere sphere(1);
+    while (state.keepRunning()) {
+        sphere.computeSphereNormal();
+    }
+    state.itemsProcessed = state.iterations * sphere.faces.size()/3;
+}
+
+struct BenchmarkSuite
+{
+    std::vector<Benchmark> benchmarks;
+    std::vector<BenchmarkResult> results;
+
+    std::vector<int> sizes;
+    std::vector<int> threadCounts;
+    double minTime;
+    int repetitions;
+    std::string filter;
+    std::string outPath;
+    Cloth::NodeOrderEnum order;
+    
+    double threshold;         // Allowed slowdown before the gate fails, 0.1 = 10%
+    std::string comparePath;  // Baseline to compare with
+    std::string inPath;       // Compare this result file instead of running
+    bool record;              // Write the result as this machine's baseline
+    bool gate;                // Compare with this machine's baseline
+
+    BenchmarkSuite()
+    {
+        add("BM_SpringForce", BM_SpringForce, true);
+        add("BM_IsometricBending", BM_IsometricBending, true);
+        add("BM_MembraneForce", BM_MembraneForce, true);
+        add("BM_NodeIntegrate", BM_NodeIntegrate, true);
+        add("BM_ComputeNormal", BM_ComputeNormal, true);
+        add("BM_CollisionResponse", BM_CollisionResponse, true);
+        add("BM_Substep", BM_Substep, true);
+        add("BM_BlockedSubstep", BM_BlockedSubstep, true);
+        add("BM_AeroSubstep", BM_AeroSubstep, true);
+        add("BM_EnsembleSubstep", BM_EnsembleSubstep, true);
+        add("BM_MultiresUpdate", BM_MultiresUpdate, true);
+        add("BM_ClothStaging", BM_ClothStaging, true);
+        add("BM_SphereInit", BM_SphereInit, false);
+        add("BM_SphereNormal", BM_SphereNormal, false);
+
+        int sizeList[] = { 10, 30, 100, 300, 1000 };
+        sizes.assign(sizeList, sizeList + 5);
+        threadCounts.push_back(1);
+        int hardware = (int)std::thread::hardware_concurrency();
+        if (hardware > 1) threadCounts.push_back(hardware);
+        minTime = 0.5;
+        repetitions = 1;
+        order = Cloth::ORDER_GRID;
+        threshold = 0.1;
+        record = false;
+        gate = false;
+    }
+    
+    /** The gate and its baselines measure a fixed, bounded set, whatever the exploratory defaults or flags are **/
+    void useGateSet()
+    {
+        static const char* gateBenchmarks[] = { "BM_SpringForce", "BM_IsometricBending", "BM_NodeIntegrate",
+                                                "BM_CollisionResponse", "BM_Substep", "BM_SphereNormal" };
+        std::vector<Benchmark> kept;
+        for (int i = 0; i < benchmarks.size(); i ++) {
+            for (int j = 0; j < sizeof(gateBenchmarks)/sizeof(gateBenchmarks[0]); j ++) {
+                if (benchmarks[i].name == gateBenchmarks[j]) kept.push_back(benchmarks[i]);
+            }
+        }
+        benchmarks = kept;
+        filter.clear();
+        
+        int sizeList[] = { 30, 100 };
+        sizes.assign(sizeList, sizeList + 2);
+        threadCounts.assign(1, 1);
+        int hardware = (int)std::thread::hardware_concurrency();
+        if (hardware > 1) threadCounts.push_back(hardware);
+        order = Cloth::ORDER_GRID;
+    }
+    
+    /** Baselines are only comparable on the same kind of machine and build **/
+    static std::string machineClass()
+    {
+#if defined(__APPLE__)
+        std::string os = "macos";
+#elif defined(__linux__)
+        std::string os = "linux";
+#else
+        std::string os = "unknown";
+#endif
+#if defined(__x86_64__) || defined(_M_X64)
+        std::string arch = "x86_64";
+#elif defined(__aarch64__) || defined(__arm64__)
+        std::string arch = "arm64";
+#else
+        std::string arch = "unknown";
+#endif
+#ifdef DEBUG
+        std::string build = "debug";
+#else
+        std::string build = "release";
+#endif
+        if (sizeof(Scalar) == sizeof(float)) build += "-float"; // Single precision builds keep their own baselines
+        return os + "-" + arch + "-" + std::to_string(std::thread::hardware_concurrency()) + "cpu-" + build;
+    }
+    
+    static const char* orderName(Cloth::NodeOrderEnum order)
+    {
+        switch (order) {
+            case Cloth::ORDER_MORTON: return "morton";
+            case Cloth::ORDER_HILBERT: return "hilbert";
+            default: return "grid";
+        }
+    }
+    
+    static std::string baselinePath()
+    {
+        return std::string("Baselines/") + BenchmarkScene::name() + "-" + machineClass() + ".json";
+    }
+
+    void add(const char* name, BenchmarkFunction function, bool scalable)
+    {
+        Benchmark b;
+        b.name = name;
+        b.function = function;
+        b.scalable = scalable;
+        benchmarks.push_back(b);
+    }
+
+    static std::vector<int> parseList(const char* s)
+    {
+        std::vector<int> list;
+        while (*s) {
+            list.push_back(atoi(s));
+            while (*s && *s != ',') s ++;
+            if (*s == ',') s ++;
+        }
+        return list;
+    }
+
+    /** Returns false when the benchmark mode was not requested **/
+    bool parseArgs(int argc, const char* argv[])
+    {
+        bool enabled = false;
+        for (int i = 1; i < argc; i ++) {
+            const char* arg = argv[i];
+            if (strcmp(arg, "--benchmark") == 0) enabled = true;
+            else if (strcmp(arg, "--benchmark_gate") == 0) {
+                enabled = true;
+                gate = true;
+                comparePath = baselinePath();
+                if (repetitions == 1) repetitions = 5;
+            }
+            else if (strcmp(arg, "--benchmark_record") == 0) {
+                enabled = true;
+                record = true;
+                if (repetitions == 1) repetitions = 5;
+            }
+            else if (strncmp(arg, "--benchmark_repetitions=", 24) == 0) repetitions = std::max(1, atoi(arg + 24));
+            else if (strncmp(arg, "--benchmark_threshold=", 22) == 0) threshold = atof(arg + 22);
+            else if (strncmp(arg, "--benchmark_compare=", 20) == 0) { enabled = true; comparePath = arg + 20; }
+            else if (strncmp(arg, "--benchmark_in=", 15) == 0) inPath = arg + 15;
+            else if (strncmp(arg, "--benchmark_filter=", 19) == 0) filter = arg + 19;
+            else if (strncmp(arg, "--benchmark_sizes=", 18) == 0) sizes = parseList(arg + 18);
+            else if (strncmp(arg, "--benchmark_threads=", 20) == 0) threadCounts = parseList(arg + 20);
+            else if (strncmp(arg, "--benchmark_min_time=", 21) == 0) minTime = atof(arg + 21);
+            else if (strncmp(arg, "--benchmark_out=", 16) == 0) outPath = arg + 16;
+            else if (strncmp(arg, "--benchmark_order=", 18) == 0) {
+                if (strcmp(arg + 18, "morton") == 0) order = Cloth::ORDER_MORTON;
+                else if (strcmp(arg + 18, "hilbert") == 0) order = Cloth::ORDER_HILBERT;
+                else order = Cloth::ORDER_GRID;
+            }
+        }
+        if (gate || record) useGateSet();
+        for (int i = 0; i < sizes.size(); i ++) {
+            if (sizes[i] < 10 || sizes[i] % 10 != 0) {
+                printf("Benchmark: Cloth size %d is not a positive multiple of 10, skipped.\n", sizes[i]);
+                sizes.erase(sizes.begin() + i --);
+            }
+        }
+        return enabled;
+    }
+
+    /** Grow the iteration count until one run lasts at least minTime **/
+    BenchmarkResult runOne(const Benchmark& b, int nodesPerSide, int threads)
+    {
+        CacheMissCounter counter;
+        counter.open(); // Before the workers start, so they inherit it
+        threadPool.resize(threads);
+        long long iterations = 1;
+        for (;;) {
+            BenchmarkState state(nodesPerSide, threads, iterations);
+            state.order = order;
+            state.cacheMisses = &counter;
+            counter.reset();
+            b.function(state);
+            if (state.realTime >= minTime || iterations >= 1000000000LL) {
+                BenchmarkResult r;
+                r.name = b.name;
+                if (b.scalable) r.name += "/" + std::to_string(nodesPerSide) + "/" + std::to_string(threads);
+                r.nodesPerSide = nodesPerSide;
+                r.threads = threads;
+                r.iterations = state.iterations;
+                r.realTime = state.realTime * 1e9 / state.iterations;
+                r.cpuTime = state.cpuTime * 1e9 / state.iterations;
+                r.itemsPerSecond = state.realTime > 0.0 ? state.itemsProcessed / state.realTime : 0.0;
+                long long misses = counter.read();
+                r.cacheMisses = misses >= 0 ? (double)misses / state.iterations : -1.0;
+                threadPool.resize(1);
+                counter.close();
+                return r;
+            }
+            double scale = state.realTime > 0.0 ? minTime * 1.4 / state.realTime : 10.0;
+            iterations = (long long)(iterations * std::max(2.0, std::min(scale, 10.0)));
+        }
+    }
+
+    /** Repeat a measurement, drop repetitions further than 3 scaled MADs from the median and average the rest **/
+    BenchmarkResult runCase(const Benchmark& b, int nodesPerSide, int threads)
+    {
+        std::vector<BenchmarkResult> runs;
+        for (int i = 0; i < repetitions; i ++) {
+            runs.push_back(runOne(b, nodesPerSide, threads));
+        }
+        
+        std::vector<double> times;
+        for (int i = 0; i < runs.size(); i ++) { times.push_back(runs[i].realTime); }
+        double median = medianOf(times);
+        std::vector<double> deviations;
+        for (int i = 0; i < times.size(); i ++) { deviations.push_back(fabs(times[i] - median)); }
+        double limit = 3.0 * 1.4826 * medianOf(deviations);
+        
+        BenchmarkResult r = runs[0];
+        r.iterations = 0;
+        r.realTime = r.cpuTime = r.itemsPerSecond = 0.0;
+        if (r.cacheMisses >= 0.0) r.cacheMisses = 0.0;
+        r.repetitions = 0;
+        for (int i = 0; i < runs.size(); i ++) {
+            if (limit > 0.0 && fabs(runs[i].realTime - median) > limit) continue;
+            r.iterations += runs[i].iterations;
+            r.realTime += runs[i].realTime;
+            r.cpuTime += runs[i].cpuTime;
+            r.itemsPerSecond += runs[i].itemsPerSecond;
+            if (r.cacheMisses >= 0.0) r.cacheMisses += runs[i].cacheMisses;
+            r.repetitions ++;
+        }
+        r.rejected = (int)runs.size() - r.repetitions;
+        r.realTime /= r.repetitions;
+        r.cpuTime /= r.repetitions;
+        r.itemsPerSecond /= r.repetitions;
+        if (r.cacheMisses >= 0.0) r.cacheMisses /= r.repetitions;
+        
+        double variance = 0.0;
+        for (int i = 0; i < runs.size(); i ++) {
+            if (limit > 0.0 && fabs(runs[i].realTime - median) > limit) continue;
+            variance += (runs[i].realTime - r.realTime) * (runs[i].realTime - r.realTime);
+        }
+        r.stddev = r.repetitions > 1 ? sqrt(variance / (r.repetitions - 1)) : 0.0;
+        return r;
+    }
+    
+    static double medianOf(std::vector<double> values)
+    {
+        std::sort(values.begin(), values.end());
+        int n = (int)values.size();
+        return n % 2 ? values[n/2] : 0.5 * (values[n/2-1] + values[n/2]);
+    }
+    
+    int run()
+    {
+        if (!inPath.empty()) { // Offline comparison of two result files
+            return compare(inPath.c_str(), comparePath.c_str());
+        }
+        if (gate) { // Fail before measuring anything
+            FILE* file = fopen(comparePath.c_str(), "rb");
+            if (file == NULL) {
+                printf("Benchmark: No baseline at %s, record one with --benchmark_record.\n", comparePath.c_str());
+                return 1;
+            }
+            fclose(file);
+        }
+        
+        printf("Benchmark: Node order %s\n", orderName(order));
+        printf("%-36s %16s %16s %12s %16s %8s %14s\n", "Benchmark", "Time(ns)", "CPU(ns)", "Iterations", "Items/s", "Stddev%", "CacheMisses");
+        for (int i = 0; i < benchmarks.size(); i ++) {
+            Benchmark& b = benchmarks[i];
+            if (!filter.empty() && b.name.find(filter) == std::string::npos) continue;
+            if (!b.scalable) {
+                report(runCase(b, 0, 1));
+                continue;
+            }
+            for (int s = 0; s < sizes.size(); s ++) {
+                for (int t = 0; t < threadCounts.size(); t ++) {
+                    report(runCase(b, sizes[s], threadCounts[t]));
+                }
+            }
+        }
+        if (!outPath.empty() && !writeJson(outPath.c_str())) return 1;
+        if (record) {
+            mkdir("Baselines", 0755);
+            if (!writeJson(baselinePath().c_str())) return 1;
+        }
+        if (!comparePath.empty()) {
+            std::string current = outPath.empty() ? std::string("Baselines/last-run.json") : outPath;
+            if (outPath.empty()) {
+                mkdir("Baselines", 0755);
+                if (!writeJson(current.c_str())) return 1;
+            }
+            return compare(current.c_str(), comparePath.c_str());
+        }
+        return 0;
+    }
+    
+    /** Returns 1 when any benchmark in both files got slower than the threshold allows, a baseline benchmark is
+        missing from the current run, or nothing could be compared **/
+    int compare(const char* currentPath, const char* baseline)
+    {
+        JsonValue current, base;
+        if (!JsonValue::parseFile(baseline, base)) {
+            printf("Benchmark: No readable baseline at %s, record one with --benchmark_record.\n", baseline);
+            return 1;
+        }
+        if (!JsonValue::parseFile(currentPath, current)) {
+            printf("Benchmark: Failed to read %s\n", currentPath);
+            return 1;
+        }
+        const JsonValue* baseContext = base.get("context");
+        const JsonValue* currentContext = current.get("context");
+        if (baseContext && currentContext) {
+            std::string baseClass = baseContext->getString("machine_class", "?");
+            std::string currentClass = currentContext->getString("machine_class", "?");
+            if (baseClass != currentClass) {
+                printf("Benchmark: Warning, baseline was recorded on %s, this run is %s.\n", baseClass.c_str(), currentClass.c_str());
+            }
+            std::string baseOrder = baseContext->getString("node_order", "grid");
+            std::string currentOrder = currentContext->getString("node_order", "grid");
+            if (baseOrder != currentOrder) {
+                printf("Benchmark: Comparing node order %s against %s.\n", currentOrder.c_str(), baseOrder.c_str());
+            }
+        }
+        
+        const JsonValue* baseList = base.get("benchmarks");
+        const JsonValue* currentList = current.get("benchmarks");
+        if (!baseList || !currentList) {
+            printf("Benchmark: Missing \"benchmarks\" array.\n");
+            return 1;
+        }
+        
+        printf("\n%-36s %16s %16s %10s %12s  %s (threshold %+.1f%%)\n", "Benchmark", "Baseline(ns)", "Current(ns)", "Change", "CacheMisses", "Status", threshold*100.0);
+        int regressions = 0, compared = 0, missing = 0;
+        for (int i = 0; i < currentList->items.size(); i ++) {
+            const JsonValue& c = currentList->items[i];
+            std::string name = c.getString("name", "");
+            const JsonValue* b = NULL;
+            for (int j = 0; j < baseList->items.size(); j ++) {
+                if (baseList->items[j].getString("name", "") == name) b = &baseList->items[j];
+            }
+            if (b == NULL) {
+                printf("%-36s %16s %16.0f %10s  new\n", name.c_str(), "-", c.getNumber("real_time", 0.0), "-");
+                continue;
+            }
+            double before = b->getNumber("real_time", 0.0);
+            double after = c.getNumber("real_time", 0.0);
+            double change = before > 0.0 ? after / before - 1.0 : 0.0;
+            double missesBefore = b->getNumber("cache_misses", -1.0);
+            double missesAfter = c.getNumber("cache_misses", -1.0);
+            char misses[32] = "n/a";
+            if (missesBefore > 0.0 && missesAfter >= 0.0) snprintf(misses, sizeof(misses), "%+.1f%%", (missesAfter / missesBefore - 1.0) * 100.0);
+            bool regressed = change > threshold;
+            compared ++;
+            if (regressed) regressions ++;
+            printf("%-36s %16.0f %16.0f %+9.1f%% %12s  %s\n", name.c_str(), before, after, change*100.0, misses, regressed ? "REGRESSED" : "ok");
+        }
+        // Renamed, removed or crashed benchmarks would otherwise pass by not being there
+        for (int j = 0; j < baseList->items.size(); j ++) {
+            const JsonValue& b = baseList->items[j];
+            std::string name = b.getString("name", "");
+            bool found = false;
+            for (int i = 0; i < currentList->items.size() && !found; i ++) { found = currentList->items[i].getString("name", "") == name; }
+            if (found) continue;
+            missing ++;
+            printf("%-36s %16.0f %16s %10s %12s  MISSING\n", name.c_str(), b.getNumber("real_time", 0.0), "-", "-", "-");
+        }
+        printf("Benchmark: %d compared, %d regressed, %d missing.\n", compared, regressions, missing);
+        if (compared == 0) printf("Benchmark: Nothing to compare, the runs have no benchmark in common.\n");
+        return regressions > 0 || missing > 0 || compared == 0 ? 1 : 0;
+    }
+
+    void report(const BenchmarkResult& r)
+    {
+        results.push_back(r);
+        char misses[32] = "n/a";
+        if (r.cacheMisses >= 0.0) snprintf(misses, sizeof(misses), "%.0f", r.cacheMisses);
+        printf("%-36s %16.0f %16.0f %12lld %16.4g %7.1f%% %14s\n", r.name.c_str(), r.realTime, r.cpuTime, r.iterations, r.itemsPerSecond,
+               r.realTime > 0.0 ? r.stddev / r.realTime * 100.0 : 0.0, misses);
+    }
+
+    /** Same layout as Google Benchmark's --benchmark_format=json **/
+    bool writeJson(const char* path)
+    {
+        FILE* file = fopen(path, "w");
+        if (file == NULL) {
+            printf("Benchmark: Failed to open %s\n", path);
+            return false;
+        }
+        char date[64];
+        std::time_t now = std::time(NULL);
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+#ifdef DEBUG
+        const char* buildType = "debug";
+#else
+        const char* buildType = "release";
+#endif
+        fprintf(file, "{\n  \"context\": {\n    \"date\": \"%s\",\n    \"num_cpus\": %d,\n    \"library_build_type\": \"%s\",\n"
+                      "    \"machine_class\": \"%s\",\n    \"scene\": \"%s\",\n    \"node_order\": \"%s\",\n    \"repetitions\": %d\n  },\n",
+                date, (int)std::thread::hardware_concurrency(), buildType, machineClass().c_str(), BenchmarkScene::name(), orderName(order), repetitions);
+        fprintf(file, "  \"benchmarks\": [\n");
+        for (int i = 0; i < results.size(); i ++) {
+            BenchmarkResult& r = results[i];
+            fprintf(file, "    {\n      \"name\": \"%s\",\n      \"run_name\": \"%s\",\n      \"nodes_per_side\": %d,\n      \"threads\": %d,\n"
+                          "      \"iterations\": %lld,\n      \"real_time\": %.3f,\n      \"cpu_time\": %.3f,\n      \"time_unit\": \"ns\",\n"
+                          "      \"stddev\": %.3f,\n      \"repetitions\": %d,\n      \"rejected\": %d,\n"
+                          "      \"items_per_second\": %.3f",
+                    r.name.c_str(), r.name.c_str(), r.nodesPerSide, r.threads, r.iterations, r.realTime, r.cpuTime,
+                    r.stddev, r.repetitions, r.rejected, r.itemsPerSecond);
+            if (r.cacheMisses >= 0.0) fprintf(file, ",\n      \"cache_misses\": %.3f", r.cacheMisses);
+            fprintf(file, "\n    }%s\n", i+1 < results.size() ? "," : "");
+        }
+        fprintf(file, "  ]\n}\n");
+        fclose(file);
+        printf("Benchmark: Wrote %s\n", path);
+        return true;
+    }
+};
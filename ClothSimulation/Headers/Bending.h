@@ -0,0 +1,189 @@
+#pragma once
+
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "Parallel.h"
+#include "Points.h"
+
+/** Isometric bending (Bergou et al. 2006): a constant quadratic energy over every pair of faces sharing an edge **/
+// For a hinge with edge x0 x1 and opposite vertices x2 (first face) and x3 (second face), with the cotangents of
+// the rest angles at the edge ends, K = (c03 + c04, c01 + c02, -c01 - c03, -c02 - c04) and the hinge adds
+// 3 / (A0 + A1) K K^T to Q. E = stiffness/2 sum_ij Q_ij <x_i, x_j> is exact for a flat rest state bent without
+// stretching, so Q depends on the rest shape only: it is assembled once and each substep is one sparse
+// matrix-vector product, force = -Q (stiffness x + damping v). Rows are nodes, so every thread writes its own
+// nodes and no coloring is needed. The positions are packed into contiguous arrays first, the product then reads
+// no node through a pointer and its inner loop is three multiply-adds over contiguous values and columns.
+template <typename T>
+struct IsometricBendingT
+{
+    typedef Vec3T<T> Vec3;
+    typedef NodeT<T> Node;
+
+    double stiffness = 0.0;
+    double damping = 0.0;
+
+    /** Hinges **/
+    std::vector<int> hingeNodes;    // Four per hinge: edge ends, then the vertices opposite the edge
+    std::vector<T> hingeK;          // Four per hinge, K scaled by sqrt(stiffness * 3 / (A0 + A1)), 0 once removed
+    std::vector<int> faceHinges;    // Three per face, the hinges across its edges, -1 for none
+
+    /** stiffness * Q in compressed sparse rows **/
+    std::vector<int> rowStart;
+    std::vector<int> columns;
+    std::vector<T> values;
+
+    std::vector<T> stateX, stateY, stateZ; // x + damping / stiffness v of every node
+
+    bool active() const { return !rowStart.empty(); }
+    int hingeCount() const { return (int)hingeNodes.size() / 4; }
+
+    void clear()
+    {
+        hingeNodes.clear();
+        hingeK.clear();
+        faceHinges.clear();
+        rowStart.clear();
+        columns.clear();
+        values.clear();
+    }
+
+    /** Hinges are given as four node indices and the two faces, the rest shape as a position per node **/
+    void build(const std::vector<Vec3>& rest, const std::vector<int>& hinges, const std::vector<int>& hingeFaces, int faceCount)
+    {
+        int nodeCount = (int)rest.size();
+        int count = (int)hinges.size() / 4;
+        hingeNodes = hinges;
+        hingeK.resize(4 * count);
+        parallelFor(0, count, [&](int h) {
+            const int* n = &hingeNodes[4*h];
+            Vec3 e0 = rest[n[1]] - rest[n[0]], e1 = rest[n[2]] - rest[n[0]], e2 = rest[n[3]] - rest[n[0]];
+            Vec3 e3 = rest[n[2]] - rest[n[1]], e4 = rest[n[3]] - rest[n[1]];
+            T c01 = cotangent(e0, e1), c02 = cotangent(e0, e2);
+            T c03 = cotangent(e0 * (T)-1.0, e3), c04 = cotangent(e0 * (T)-1.0, e4);
+            T area = (Vec3::cross(e0, e1).length() + Vec3::cross(e0, e2).length()) / 2;
+            T scale = area > 0 ? sqrt(stiffness * 3.0 / area) : 0;
+            hingeK[4*h] = (c03 + c04) * scale;
+            hingeK[4*h+1] = (c01 + c02) * scale;
+            hingeK[4*h+2] = -(c01 + c03) * scale;
+            hingeK[4*h+3] = -(c02 + c04) * scale;
+        });
+        faceHinges.assign(3 * faceCount, -1);
+        for (int h = 0; h < count; h ++) {
+            for (int k = 0; k < 2; k ++) {
+                int* slot = &faceHinges[3 * hingeFaces[2*h+k]];
+                while (*slot >= 0) { slot ++; }
+                *slot = h;
+            }
+        }
+
+        /** Hinges of each node, in hinge order so every row sums in the same order on any thread count **/
+        std::vector<int> nodeStart(nodeCount + 1, 0);
+        for (int i = 0; i < hingeNodes.size(); i ++) { nodeStart[hingeNodes[i] + 1] ++; }
+        for (int i = 0; i < nodeCount; i ++) { nodeStart[i + 1] += nodeStart[i]; }
+        std::vector<int> nodeHinges(hingeNodes.size());
+        std::vector<int> fill(nodeStart.begin(), nodeStart.end() - 1);
+        for (int i = 0; i < hingeNodes.size(); i ++) { nodeHinges[fill[hingeNodes[i]] ++] = i; } // Hinge * 4 + slot
+
+        /** Pattern: the nodes sharing a hinge with each node, then the values row by row **/
+        std::vector<int> rowCount(nodeCount);
+        parallelFor(0, nodeCount, [&](int i) { rowCount[i] = (int)rowColumns(i, nodeStart, nodeHinges).size(); });
+        rowStart.assign(nodeCount + 1, 0);
+        for (int i = 0; i < nodeCount; i ++) { rowStart[i + 1] = rowStart[i] + rowCount[i]; }
+        columns.resize(rowStart.back());
+        values.assign(rowStart.back(), 0);
+        parallelFor(0, nodeCount, [&](int i) {
+            std::vector<int> row = rowColumns(i, nodeStart, nodeHinges);
+            std::copy(row.begin(), row.end(), columns.begin() + rowStart[i]);
+            for (int e = nodeStart[i]; e < nodeStart[i + 1]; e ++) { addHinge(i, nodeHinges[e] / 4, nodeHinges[e] % 4, 1); }
+        });
+        stateX.resize(nodeCount);
+        stateY.resize(nodeCount);
+        stateZ.resize(nodeCount);
+    }
+
+    std::vector<int> rowColumns(int i, const std::vector<int>& nodeStart, const std::vector<int>& nodeHinges) const
+    {
+        std::vector<int> row;
+        for (int e = nodeStart[i]; e < nodeStart[i + 1]; e ++) {
+            const int* n = &hingeNodes[4 * (nodeHinges[e] / 4)];
+            row.insert(row.end(), n, n + 4);
+        }
+        std::sort(row.begin(), row.end());
+        row.erase(std::unique(row.begin(), row.end()), row.end());
+        return row;
+    }
+
+    /** Adds sign times the row of node i of hinge h, where i is its node at slot a **/
+    void addHinge(int i, int h, int a, int sign)
+    {
+        const int* n = &hingeNodes[4*h];
+        const T* k = &hingeK[4*h];
+        for (int b = 0; b < 4; b ++) {
+            int* column = std::lower_bound(&columns[rowStart[i]], &columns[0] + rowStart[i + 1], n[b]);
+            values[column - &columns[0]] += sign * k[a] * k[b];
+        }
+    }
+
+    /** A face torn off takes the hinges across its edges along **/
+    void removeFace(int f)
+    {
+        if (!active()) return;
+        for (int k = 0; k < 3; k ++) {
+            int h = faceHinges[3*f+k];
+            if (h < 0 || (hingeK[4*h] == 0 && hingeK[4*h+1] == 0)) continue; // Removed with its other face
+            for (int a = 0; a < 4; a ++) { addHinge(hingeNodes[4*h+a], h, a, -1); }
+            for (int a = 0; a < 4; a ++) { hingeK[4*h+a] = 0; }
+        }
+    }
+
+    /** force -= stiffness Q x + damping Q v, asleep nodes are skipped, their force is dropped anyway **/
+    void apply(const std::vector<Node*>& nodes)
+    {
+        T beta = stiffness > 0 ? damping / stiffness : 0;
+        int count = (int)nodes.size();
+        parallelFor(0, count, [&](int i) {
+            const Node* n = nodes[i];
+            stateX[i] = n->position.x + beta * n->velocity.x;
+            stateY[i] = n->position.y + beta * n->velocity.y;
+            stateZ[i] = n->position.z + beta * n->velocity.z;
+        });
+        const int* start = &rowStart[0];
+        const int* column = columns.empty() ? NULL : &columns[0];
+        const T* value = values.empty() ? NULL : &values[0];
+        const T* x = &stateX[0];
+        const T* y = &stateY[0];
+        const T* z = &stateZ[0];
+        parallelFor(0, count, [&](int i) {
+            Node* n = nodes[i];
+            if (n->isAsleep) return;
+            T fx = 0, fy = 0, fz = 0;
+            for (int e = start[i]; e < start[i + 1]; e ++) {
+                T q = value[e];
+                int j = column[e];
+                fx += q * x[j];
+                fy += q * y[j];
+                fz += q * z[j];
+            }
+            n->force.x -= fx;
+            n->force.y -= fy;
+            n->force.z -= fz;
+        });
+    }
+
+    /** Gershgorin row sum of stiffness * Q at node i, see SimulationT::estimateStability **/
+    double rowSum(int i) const
+    {
+        double sum = 0.0;
+        for (int e = rowStart[i]; e < rowStart[i + 1]; e ++) { sum += fabs((double)values[e]); }
+        return sum;
+    }
+
+    static T cotangent(const Vec3& a, const Vec3& b)
+    {
+        T sine = Vec3::cross(a, b).length();
+        return sine > 0 ? Vec3::dot(a, b) / sine : 0;
+    }
+};
@@ -1,18 +1,68 @@
 #pragma once
 
+#include <algorithm>
+#include <mutex>
+#include <numeric>
 #include <vector>
 
+#include "Arena.h"
+#include "Attachment.h"
+#include "Bending.h"
+#include "Log.h"
+#include "Membrane.h"
 #include "Spring.h"
 #include "Rigid.h"
+#include "Parallel.h"
+#include "Topology.h"
+#include "Wind.h"
 
-class Cloth
+/** Square block of nodes that falls asleep and wakes up as a whole **/
+struct ClothTile
+{
+    std::vector<int> nodes;   // Node indices
+    int tileX, tileY;
+    int quietSubsteps = 0;    // Substeps in a row with every node below the sleep energy
+    double maxEnergy = 0.0;   // Largest kinetic energy of a node in the last substep
+    bool asleep = false;
+    bool normalsFrozen = false; // Asleep with all neighbours asleep, normals of its nodes cannot change
+    Vec3T<double> wind;         // Wind at its first node this frame
+    Vec3T<double> restWind;     // Wind when it fell asleep
+};
+
+/** Spring crossing the border of a block, it reads both ends from the halo **/
+struct ClothBorderSpring
+{
+    int spring;         // Index into springs
+    int halo1, halo2;   // Halo slots of node1 and node2
+    bool inside1;       // node1 belongs to the block, otherwise node2
+};
+
+/** Cache-sized square of the grid that runs force, integrate and collide back to back **/
+struct ClothBlock
+{
+    std::vector<int> nodes;                 // Node indices, in memory order
+    std::vector<int> springs;               // Both ends in the block
+    std::vector<ClothBorderSpring> border;  // One end in the block
+};
+
+template <typename T>
+class ClothT
 {
 public:
+    typedef Vec3T<T> Vec3;
+    typedef NodeT<T> Node;
+    typedef SpringT<T> Spring;
+    
     const int nodesDensity = 4;
     const int iterationFreq = 25;
     const double structuralCoef = 1000.0;
     const double shearCoef = 50.0;
     const double bendingCoef = 400.0;
+    const double isometricBendingCoef = 0.02;   // See useIsometricBending(), drapes about like the bending springs
+    const double isometricBendingDamp = 0.0002; // Rayleigh: 0.01 s of the stiffness
+    const double membraneYoung = 1000.0;        // See useMembrane(), N/m
+    const double membranePoisson = 0.3;
+    const double membraneDamp = 2.0;
     
     enum DrawModeEnum{
         DRAW_NODES,
@@ -21,55 +71,247 @@ public:
     };
     DrawModeEnum drawMode = DRAW_FACES;
     
+    /** Bending: the i+2 springs of init(), or the isometric model of Bending.h, see useIsometricBending() **/
+    enum BendingModelEnum{
+        BENDING_SPRINGS,
+        BENDING_ISOMETRIC
+    };
+    BendingModelEnum bendingModel = BENDING_SPRINGS;
+    IsometricBendingT<T> isometric;
+    
+    /** Stretch and shear: the structural and shear springs of init(), or a triangle membrane, see useMembrane() **/
+    enum StretchModelEnum{
+        STRETCH_SPRINGS,
+        STRETCH_STVK,       // Saint Venant-Kirchhoff
+        STRETCH_COROTATED   // Co-rotated linear
+    };
+    StretchModelEnum stretchModel = STRETCH_SPRINGS;
+    MembraneT<T> membrane;
+    
+    /** Long-range attachments: off unless useLongRangeAttachments() was called **/
+    LongRangeAttachmentT<T> attachments;
+    
+    /** Memory order of the nodes, see reorder() **/
+    enum NodeOrderEnum{
+        ORDER_GRID,     // Row by row, as created
+        ORDER_MORTON,   // Z-order curve of the rest positions
+        ORDER_HILBERT   // Hilbert curve of the rest positions, no long jumps between quadrants
+    };
+    
     Vec3 clothPos;
     
     int width, height;
     int nodesPerRow, nodesPerCol;
     
+    Arena arena;                  // Owns the nodes and springs
+    Node* nodeBlock;              // All nodes, in the order init() made them
+    Spring* springBlock;          // The springs of init(), the same
     std::vector<Node*> nodes;
 	std::vector<Spring*> springs;
 	std::vector<Node*> faces;
+    std::vector<int> faceIndices; // Node indices of faces
+    std::vector<int> gridNodes;   // Node index of grid cell (x, y) at y*nodesPerRow+x
+    
+    /** Graph coloring: no two entries of one color share a node, so a color can be processed in parallel **/
+    std::vector< std::vector<int> > springColors; // Spring indices
+    std::vector< std::vector<int> > faceColors;   // Face indices
+    std::vector<int> springColor, springColorPos; // Color of each spring and its place in it, -1 once torn
+    std::vector<int> faceColor, faceColorPos;
     
     Vec2 pin1;
     Vec2 pin2;
     
-	Cloth(Vec3 pos, Vec2 size)
+    /** Sleeping **/
+    const int tileSize = 8;         // Nodes per tile side
+    double sleepEnergy = 1e-5;      // Kinetic energy per node under which a tile counts as quiet
+    double wakeEnergy = 1e-2;       // A tile moving this much wakes its sleeping neighbours
+    int sleepSubsteps = 50;         // Quiet substeps before a tile falls asleep
+    double wakeMargin = 0.5;        // Distance to a moving collider that wakes a tile
+    double wakeWind = 0.5;          // Change of the wind since a tile fell asleep that wakes it, m/s
+    int tilesPerRow, tilesPerCol;
+    std::vector<ClothTile> tiles;
+    std::vector<int> nodeTile;      // Tile of each node
+    int sleepingTiles = 0;
+    Vec3T<double> lastBallCenter;
+    
+    /** Blocked execution **/
+    const int blockSize = 32;       // Nodes per block side, a block with its springs is a few hundred KB
+    int blocksPerRow, blocksPerCol;
+    std::vector<ClothBlock> blocks;
+    std::vector<int> haloNodes;     // Nodes read by border springs
+    std::vector<Vec3> haloPosition; // Their state at the start of the substep
+    std::vector<Vec3> haloVelocity;
+    
+    /** Aerodynamics **/
+    std::vector<Vec3> faceNormals;  // Area weighted (length is twice the area), from the last computeNormal
+    std::vector<Vec3> faceWind;     // Wind at each face centre, sampled once per frame
+    std::vector<Vec3> faceForce;    // Aerodynamic force of each face, a third of it for each of its nodes
+    std::vector<Vec3> nodeAero;     // Aerodynamic force of each node, held between updates
+    std::vector<int> nodeFaceStart; // Faces of node i are nodeFaceCount[i] entries of nodeFaces from nodeFaceStart[i]
+    std::vector<int> nodeFaceCount;
+    std::vector<int> nodeFaces;
+    
+    /** Tearing: a spring stretched past tearStretch times its rest length breaks and takes its faces along **/
+    // Nothing is compacted or reallocated: torn springs and removed faces stay in place, skipped or degenerate,
+    // so the render buffers sized at init still fit. Each tear costs a few swap-removals, not a rebuild.
+    double tearStretch = 0.0;           // 0 never tears
+    std::vector<int> springFaces;       // The up to two faces on the edge of each spring, -1 for none
+    std::vector<int> pendingTears;      // Springs found over the limit during the substep, see applyTears
+    std::mutex tearLock;
+    int tearCount = 0;                  // Springs torn and faces removed since init
+    std::vector<int> faceEdits;         // Faces whose indices changed after init, in order, for the render index buffer
+    
+	ClothT(const Vec3& pos, const Vec2& size)
 	{
         clothPos = pos;
         width = size.x;
         height = size.y;
         init();
 	}
-	~Cloth()
+    ClothT(const Vec3& pos, const Vec2& size, int density) : nodesDensity(density) // Benchmarks scale the node count
+    {
+        clothPos = pos;
+        width = size.x;
+        height = size.y;
+        init();
+    }
+	~ClothT()
 	{ 
-		for (int i = 0; i < nodes.size(); i++) { delete nodes[i]; }
-		for (int i = 0; i < springs.size(); i++) { delete springs[i]; }
-		nodes.clear();
+		nodes.clear(); // The arena frees the nodes and springs themselves
 		springs.clear();
 		faces.clear();
+        faceIndices.clear();
+        gridNodes.clear();
+        springColors.clear();
+        faceColors.clear();
+        tiles.clear();
+        nodeTile.clear();
+        blocks.clear();
+        haloNodes.clear();
 	}
  
 public:
-    Node* getNode(int x, int y) { return nodes[y*nodesPerRow+x]; }
-    Vec3 computeFaceNormal(Node* n1, Node* n2, Node* n3)
+    int gridNode(int x, int y) const { return gridNodes[y*nodesPerRow+x]; }
+    Node* getNode(int x, int y) { return nodes[gridNode(x, y)]; }
+    static Vec3 computeFaceNormal(const Node* n1, const Node* n2, const Node* n3)
     {
         return Vec3::cross(n2->position - n1->position, n3->position - n1->position);
     }
     
-    void pin(Vec2 index, Vec3 offset) // Pin cloth's (x, y) node with offset
+    void pin(const Vec2& index, const Vec3& offset) // Pin cloth's (x, y) node with offset
     {
         if (!(index.x < 0 || index.x >= nodesPerRow || index.y < 0 || index.y >= nodesPerCol)) {
             getNode(index.x, index.y)->position += offset;
             getNode(index.x, index.y)->isFixed = true;
+            attachments.addAnchor(gridNode(index.x, index.y));
+            if (!tiles.empty()) wakeTile(nodeTile[gridNode(index.x, index.y)]);
         }
     }
-    void unPin(Vec2 index) // Unpin cloth's (x, y) node
+    void unPin(const Vec2& index) // Unpin cloth's (x, y) node
     {
         if (!(index.x < 0 || index.x >= nodesPerRow || index.y < 0 || index.y >= nodesPerCol)) {
             getNode(index.x, index.y)->isFixed = false;
+            attachments.removeAnchor(gridNode(index.x, index.y));
+            wakeTile(nodeTile[gridNode(index.x, index.y)]);
         }
     }
     
+    /** Smallest color not used yet by any of the given nodes, marks it as used **/
+    static int takeColor(std::vector<unsigned long long>& used, int* indices, int count)
+    {
+        unsigned long long taken = 0;
+        for (int i = 0; i < count; i ++) { taken |= used[indices[i]]; }
+        int color = 0;
+        while (taken & (1ULL << color)) { color ++; }
+        for (int i = 0; i < count; i ++) { used[indices[i]] |= (1ULL << color); }
+        return color;
+    }
+    
+    /** Index in nodes of a node pointer: the nodes are one arena array, reorder() only permutes the pointers **/
+    struct NodeIndex
+    {
+        const Node* base;
+        std::vector<int> slots; // Index of the node in each array slot
+        int operator[](const Node* n) const { return slots[n - base]; }
+    };
+    NodeIndex nodeIndices() const
+    {
+        NodeIndex index;
+        index.base = nodeBlock;
+        index.slots.resize(nodes.size());
+        for (int i = 0; i < nodes.size(); i ++) { index.slots[nodes[i] - nodeBlock] = i; }
+        return index;
+    }
+    
+    /** Greedy coloring of springs and faces in their current order, redone whenever that order changes **/
+    void colorGraph()
+    {
+        NodeIndex index = nodeIndices();
+        
+        std::vector<unsigned long long> used(nodes.size(), 0);
+        springColors.clear();
+        springColor.assign(springs.size(), -1);
+        springColorPos.assign(springs.size(), -1);
+        for (int i = 0; i < springs.size(); i ++) {
+            if (springs[i]->isTorn) continue;
+            int indices[2] = { index[springs[i]->node1], index[springs[i]->node2] };
+            int color = takeColor(used, indices, 2);
+            if (color >= springColors.size()) springColors.resize(color+1);
+            springColor[i] = color;
+            springColorPos[i] = (int)springColors[color].size();
+            springColors[color].push_back(i);
+        }
+        
+        used.assign(nodes.size(), 0);
+        faceColors.clear();
+        faceColor.assign(faces.size()/3, -1);
+        faceColorPos.assign(faces.size()/3, -1);
+        for (int i = 0; i < faces.size()/3; i ++) {
+            if (faceRemoved(i)) continue;
+            int color = takeColor(used, &faceIndices[3*i], 3);
+            if (color >= faceColors.size()) faceColors.resize(color+1);
+            faceColor[i] = color;
+            faceColorPos[i] = (int)faceColors[color].size();
+            faceColors[color].push_back(i);
+        }
+    }
+    
+    /** Removes item from its bucket by moving the bucket's last item into its place **/
+    static void removeFromBucket(std::vector< std::vector<int> >& buckets, std::vector<int>& bucketOf, std::vector<int>& position, int item)
+    {
+        if (bucketOf[item] < 0) return;
+        std::vector<int>& bucket = buckets[bucketOf[item]];
+        int last = bucket.back();
+        bucket[position[item]] = last;
+        position[last] = position[item];
+        bucket.pop_back();
+        bucketOf[item] = -1;
+        position[item] = -1;
+    }
+    
+    void placeFace(int f, const int* indices)
+    {
+        for (int k = 0; k < 3; k ++) {
+            faceIndices[3*f+k] = indices[k];
+            faces[3*f+k] = nodes[indices[k]];
+        }
+    }
+    
+    /** Index of the first spring init() builds at grid (i, j), init() builds firstSpring(nodesPerRow, 0) in total **/
+    // Per (i, j): structural and shear springs towards i+1 while there is a next row, bending towards i+2,
+    // and the same along j. Summed over the rows before i and the columns before j.
+    int firstSpring(int i, int j) const
+    {
+        int rows = nodesPerRow, cols = nodesPerCol;
+        int cols1 = std::max(cols-1, 0), cols2 = std::max(cols-2, 0);
+        int rowsNext = std::min(i, std::max(rows-1, 0)), rowsAfterNext = std::min(i, std::max(rows-2, 0)); // Rows before i with one
+        int rowStart = cols*(rowsNext + rowsAfterNext) + cols1*(i + 2*rowsNext) + cols2*i;
+        int next = i < rows-1, afterNext = i < rows-2;
+        return rowStart + j*(next + afterNext) + std::min(j, cols1)*(1 + 2*next) + std::min(j, cols2);
+    }
+    
+    bool faceRemoved(int f) const { return faceIndices[3*f] == faceIndices[3*f+1] && faceIndices[3*f] == faceIndices[3*f+2]; }
+    
 	void init()
 	{
         nodesPerRow = width * nodesDensity;
@@ -78,137 +320,1013 @@ public:
         pin1 = Vec2(0, 0);
         pin2 = Vec2(nodesPerRow-1, 0);
         
+        int nodeCount = nodesPerRow*nodesPerCol;
+        LOG_INFO("Init cloth with %d nodes\n", nodeCount);
+        
+        /** Nodes, springs and faces are built in parallel, each at the index it would get when built one by one **/
+        // Every count and offset is known in closed form, so everything is allocated exactly, once.
+        int rows = nodesPerRow, cols = nodesPerCol;
+        
         /** Add nodes **/
-        printf("Init cloth with %d nodes\n", nodesPerRow*nodesPerCol);
-        for (int i = 0; i < nodesPerRow; i ++) {
-            for (int j = 0; j < nodesPerCol; j ++) {
-                /** Create node by position **/
-                Node* node = new Node(Vec3((double)j/nodesDensity, -((double)i/nodesDensity), 0));
-                /** Set texture coordinates **/
-                node->texCoord.x = (double)j/(nodesPerRow-1);
-                node->texCoord.y = (double)i/(1-nodesPerCol);
-                /** Add node to cloth **/
-                nodes.push_back(node);
-                
-                printf("\t[%d, %d] (%f, %f, %f) - (%f, %f)\n", i, j, node->position.x, node->position.y, node->position.z, node->texCoord.x, node->texCoord.y);
-            }
-            std::cout << std::endl;
+        nodeBlock = arena.allocateArray<Node>(nodeCount);
+        nodes.resize(nodeCount);
+        parallelFor(0, nodeCount, [&](int n) {
+            int i = n / cols, j = n % cols;
+            /** Create node by position **/
+            Node* node = new (&nodeBlock[n]) Node(Vec3((double)j/nodesDensity, -((double)i/nodesDensity), 0));
+            /** Set texture coordinates **/
+            node->texCoord.x = (double)j/(nodesPerRow-1);
+            node->texCoord.y = (double)i/(1-nodesPerCol);
+            nodes[n] = node;
+        });
+        gridNodes.resize(nodes.size());
+        std::iota(gridNodes.begin(), gridNodes.end(), 0);
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+        for (int i = 0; i < nodeCount; i ++) {
+            const Node* node = nodes[i];
+            LOG_DEBUG("\t[%d, %d] (%f, %f, %f) - (%f, %f)\n", i / cols, i % cols, node->position.x, node->position.y, node->position.z, node->texCoord.x, node->texCoord.y);
         }
+#endif
         
         /** Add springs **/
-        for (int i = 0; i < nodesPerRow; i ++) {
-            for (int j = 0; j < nodesPerCol; j ++) {
-                /** Structural **/
-                if (i < nodesPerRow-1) springs.push_back(new Spring(getNode(i, j), getNode(i+1, j), structuralCoef));
-                if (j < nodesPerCol-1) springs.push_back(new Spring(getNode(i, j), getNode(i, j+1), structuralCoef));
-                /** Shear **/
-                if (i < nodesPerRow-1 && j < nodesPerCol-1) {
-                    springs.push_back(new Spring(getNode(i, j), getNode(i+1, j+1), shearCoef));
-                    springs.push_back(new Spring(getNode(i+1, j), getNode(i, j+1), shearCoef));
-                }
-                /** Bending **/
-                if (i < nodesPerRow-2) springs.push_back(new Spring(getNode(i, j), getNode(i+2, j), bendingCoef));
-                if (j < nodesPerCol-2) springs.push_back(new Spring(getNode(i, j), getNode(i, j+2), bendingCoef));
+        int springCount = firstSpring(rows, 0);
+        springBlock = arena.allocateArray<Spring>(springCount);
+        springs.resize(springCount);
+        parallelFor(0, nodeCount, [&](int n) {
+            int i = n / cols, j = n % cols;
+            int s = firstSpring(i, j);
+            auto place = [&](int x1, int y1, int x2, int y2, double k) {
+                springs[s] = new (&springBlock[s]) Spring(getNode(x1, y1), getNode(x2, y2), k);
+                s ++;
+            };
+            /** Structural **/
+            if (i < rows-1) place(i, j, i+1, j, structuralCoef);
+            if (j < cols-1) place(i, j, i, j+1, structuralCoef);
+            /** Shear **/
+            if (i < rows-1 && j < cols-1) {
+                place(i, j, i+1, j+1, shearCoef);
+                place(i+1, j, i, j+1, shearCoef);
             }
-        }
+            /** Bending **/
+            if (i < rows-2) place(i, j, i+2, j, bendingCoef);
+            if (j < cols-2) place(i, j, i, j+2, bendingCoef);
+        });
         
         pin(pin1, Vec3(1.0, 0.0, 0.0));
         pin(pin2, Vec3(-1.0, 0.0, 0.0));
         
 		/** Triangle faces **/
-        for (int i = 0; i < nodesPerRow-1; i ++) {
-            for (int j = 0; j < nodesPerCol-1; j ++) {
-                // Left upper triangle
-                faces.push_back(getNode(i+1, j));
-                faces.push_back(getNode(i, j));
-                faces.push_back(getNode(i, j+1));
-                // Right bottom triangle
-                faces.push_back(getNode(i+1, j+1));
-                faces.push_back(getNode(i+1, j));
-                faces.push_back(getNode(i, j+1));
-            }
+        int faceCount = std::max(rows-1, 0) * std::max(cols-1, 0) * 2;
+        faceIndices.resize(3*faceCount);
+        faces.resize(3*faceCount);
+        parallelFor(0, faceCount/2, [&](int q) {
+            int i = q / (cols-1), j = q % (cols-1);
+            // Left upper triangle
+            int upper[3] = { gridNode(i+1, j), gridNode(i, j), gridNode(i, j+1) };
+            placeFace(2*q, upper);
+            // Right bottom triangle
+            int lower[3] = { gridNode(i+1, j+1), gridNode(i+1, j), gridNode(i, j+1) };
+            placeFace(2*q+1, lower);
+        });
+        
+        if (!loadTopology(ORDER_GRID)) {
+            colorGraph();
+            initBlocks();
+            initNodeFaces();
+            saveTopology(ORDER_GRID);
         }
+        initTiles();
+        computeNormal();
 	}
+    
+    /** Space-filling curve keys of 16 bit cell coordinates **/
+    static unsigned long long mortonKey(unsigned x, unsigned y)
+    {
+        unsigned long long key = 0;
+        for (int b = 0; b < 16; b ++) {
+            key |= (unsigned long long)((x >> b) & 1) << (2*b);
+            key |= (unsigned long long)((y >> b) & 1) << (2*b+1);
+        }
+        return key;
+    }
+    static unsigned long long hilbertKey(unsigned x, unsigned y)
+    {
+        unsigned long long key = 0;
+        for (unsigned s = 1u << 15; s > 0; s >>= 1) {
+            unsigned rx = (x & s) ? 1 : 0;
+            unsigned ry = (y & s) ? 1 : 0;
+            key += (unsigned long long)s * s * ((3 * rx) ^ ry);
+            if (ry == 0) { // Rotate the quadrant
+                if (rx == 1) {
+                    x = 0xFFFF - x;
+                    y = 0xFFFF - y;
+                }
+                std::swap(x, y);
+            }
+        }
+        return key;
+    }
+    
+    /** Sort nodes along a space-filling curve of their rest positions, springs and faces by their first node **/
+    // Neighbours in the cloth end up close in memory, so the spring, normal and tile loops touch fewer cache lines.
+    // Only valid before the simulation starts: every index table is rebuilt, per-node state is kept.
+    void reorder(NodeOrderEnum order)
+    {
+        if (order == ORDER_GRID || nodes.empty()) return;
+        if (loadTopology(order)) {
+            initTiles();
+            initNodeModels();
+            return;
+        }
+        int count = (int)nodes.size();
+        
+        /** Curve key of every node, the cloth plane quantized to 16 bits per axis **/
+        T minX = nodes[0]->position.x, maxX = minX, minY = nodes[0]->position.y, maxY = minY;
+        for (int i = 0; i < count; i ++) {
+            minX = std::min(minX, nodes[i]->position.x);
+            maxX = std::max(maxX, nodes[i]->position.x);
+            minY = std::min(minY, nodes[i]->position.y);
+            maxY = std::max(maxY, nodes[i]->position.y);
+        }
+        double scaleX = maxX > minX ? 65535.0 / (maxX - minX) : 0.0;
+        double scaleY = maxY > minY ? 65535.0 / (maxY - minY) : 0.0;
+        std::vector<unsigned long long> keys(count);
+        for (int i = 0; i < count; i ++) {
+            unsigned x = (unsigned)((nodes[i]->position.x - minX) * scaleX + 0.5);
+            unsigned y = (unsigned)((nodes[i]->position.y - minY) * scaleY + 0.5);
+            keys[i] = order == ORDER_MORTON ? mortonKey(x, y) : hilbertKey(x, y);
+        }
+        
+        /** Nodes **/
+        std::vector<int> newToOld(count), oldToNew(count);
+        std::iota(newToOld.begin(), newToOld.end(), 0);
+        std::stable_sort(newToOld.begin(), newToOld.end(), [&](int a, int b) { return keys[a] < keys[b]; });
+        std::vector<Node*> sorted(count);
+        for (int i = 0; i < count; i ++) {
+            sorted[i] = nodes[newToOld[i]];
+            oldToNew[newToOld[i]] = i;
+        }
+        nodes.swap(sorted);
+        for (int i = 0; i < gridNodes.size(); i ++) { gridNodes[i] = oldToNew[gridNodes[i]]; }
+        
+        /** Faces **/
+        int faceCount = (int)faceIndices.size() / 3;
+        std::vector<int> faceFirst(faceCount), faceOrder(faceCount);
+        for (int i = 0; i < faceCount; i ++) {
+            for (int k = 0; k < 3; k ++) { faceIndices[3*i+k] = oldToNew[faceIndices[3*i+k]]; }
+            faceFirst[i] = std::min(faceIndices[3*i], std::min(faceIndices[3*i+1], faceIndices[3*i+2]));
+        }
+        std::iota(faceOrder.begin(), faceOrder.end(), 0);
+        std::stable_sort(faceOrder.begin(), faceOrder.end(), [&](int a, int b) { return faceFirst[a] < faceFirst[b]; });
+        std::vector<int> sortedIndices(faceIndices.size());
+        for (int i = 0; i < faceCount; i ++) {
+            for (int k = 0; k < 3; k ++) {
+                sortedIndices[3*i+k] = faceIndices[3*faceOrder[i]+k];
+                faces[3*i+k] = nodes[sortedIndices[3*i+k]];
+            }
+        }
+        faceIndices.swap(sortedIndices);
+        
+        /** Springs **/
+        NodeIndex index = nodeIndices();
+        std::vector<int> springFirst(springs.size()), springOrder(springs.size());
+        for (int i = 0; i < springs.size(); i ++) {
+            springFirst[i] = std::min(index[springs[i]->node1], index[springs[i]->node2]);
+        }
+        std::iota(springOrder.begin(), springOrder.end(), 0);
+        std::stable_sort(springOrder.begin(), springOrder.end(), [&](int a, int b) { return springFirst[a] < springFirst[b]; });
+        std::vector<Spring*> sortedSprings(springs.size());
+        for (int i = 0; i < springs.size(); i ++) { sortedSprings[i] = springs[springOrder[i]]; }
+        springs.swap(sortedSprings);
+        
+        colorGraph();
+        initTiles();
+        initBlocks();
+        initNodeFaces();
+        saveTopology(order);
+        initNodeModels();
+    }
+    
+    /** The models that index nodes, rebuilt in the new node order whether the topology was sorted or cached **/
+    void initNodeModels()
+    {
+        if (bendingModel == BENDING_ISOMETRIC) initIsometric();
+        if (stretchModel != STRETCH_SPRINGS) initMembrane();
+        if (attachments.active()) initAttachments();
+        computeNormal();
+    }
+    
+    /** Replaces the bending springs by the isometric model, before the simulation starts **/
+    // The springs are compacted, so the cloth is no longer the one of init() and the topology cache is skipped.
+    void useIsometricBending(double stiffness, double damping)
+    {
+        removeSprings(false);
+        bendingModel = BENDING_ISOMETRIC;
+        isometric.stiffness = stiffness;
+        isometric.damping = damping;
+        initIsometric();
+    }
+    
+    /** Replaces the structural and shear springs by a triangle membrane, before the simulation starts **/
+    // Young's modulus is per unit of cloth width: 1000 N/m stretches about like the structural springs.
+    void useMembrane(StretchModelEnum model, double young, double poisson, double damping)
+    {
+        if (model == STRETCH_SPRINGS) return;
+        removeSprings(true);
+        stretchModel = model;
+        membrane.corotated = model == STRETCH_COROTATED;
+        membrane.setMaterial(young, poisson);
+        membrane.damping = damping;
+        initMembrane();
+    }
+    
+    /** Drops the structural and shear springs (up to 1.7 node spacings long), or the bending ones **/
+    void removeSprings(bool stretch)
+    {
+        T spacing = 1.0 / nodesDensity;
+        std::vector<Spring*> kept;
+        for (int i = 0; i < springs.size(); i ++) {
+            if (!springs[i]->isTorn && (springs[i]->restLen < 1.7 * spacing) != stretch) kept.push_back(springs[i]);
+        }
+        LOG_INFO("%d %s springs removed\n", (int)(springs.size() - kept.size()), stretch ? "structural and shear" : "bending");
+        springs.swap(kept);
+        colorGraph();
+        initBlocks();
+        initNodeFaces();
+    }
+    
+    /** Flat rest shape of the grid, by node index **/
+    std::vector<Vec3> restPositions() const
+    {
+        std::vector<Vec3> rest(nodes.size());
+        for (int g = 0; g < gridNodes.size(); g ++) {
+            rest[gridNodes[g]] = Vec3((double)(g % nodesPerCol)/nodesDensity, -((double)(g / nodesPerCol)/nodesDensity), 0);
+        }
+        return rest;
+    }
+    
+    /** Edges of the faces left, both ends once each with their faces (-1 for none), and every shared edge as a hinge **/
+    // A hinge is four nodes, the edge ends and then the node opposite the edge in each face, and its two faces.
+    void faceEdges(std::vector<int>& edges, std::vector<int>& edgeFaces, std::vector<int>& hinges, std::vector<int>& hingeFaces) const
+    {
+        std::vector< std::pair<long long, int> > sides; // Both ends as one key, the face entry opposite the edge
+        for (int f = 0; f < faceIndices.size() / 3; f ++) {
+            if (faceRemoved(f)) continue;
+            for (int k = 0; k < 3; k ++) {
+                int a = faceIndices[3*f+k], b = faceIndices[3*f+(k+1)%3];
+                sides.push_back(std::make_pair((long long)std::min(a, b) * nodes.size() + std::max(a, b), 3*f+(k+2)%3));
+            }
+        }
+        std::sort(sides.begin(), sides.end());
+        for (int i = 0; i < sides.size(); i ++) {
+            int edge[2] = { (int)(sides[i].first / nodes.size()), (int)(sides[i].first % nodes.size()) };
+            edges.insert(edges.end(), edge, edge + 2);
+            bool shared = i + 1 < sides.size() && sides[i].first == sides[i + 1].first;
+            edgeFaces.push_back(sides[i].second / 3);
+            edgeFaces.push_back(shared ? sides[i + 1].second / 3 : -1);
+            if (!shared) continue;
+            int hinge[4] = { edge[0], edge[1], faceIndices[sides[i].second], faceIndices[sides[i + 1].second] };
+            hinges.insert(hinges.end(), hinge, hinge + 4);
+            hingeFaces.push_back(sides[i].second / 3);
+            hingeFaces.push_back(sides[i + 1].second / 3);
+            i ++;
+        }
+    }
+    
+    void initIsometric()
+    {
+        std::vector<int> edges, edgeFaces, hinges, hingeFaces;
+        faceEdges(edges, edgeFaces, hinges, hingeFaces);
+        isometric.clear();
+        isometric.build(restPositions(), hinges, hingeFaces, (int)faceIndices.size() / 3);
+        LOG_INFO("Isometric bending: %d hinges, %d nonzeros\n", isometric.hingeCount(), (int)isometric.values.size());
+    }
+    
+    /** Long-range attachments to the pinned nodes, see Attachment.h **/
+    void useLongRangeAttachments(double stretch)
+    {
+        attachments.stretch = stretch;
+        initAttachments();
+    }
+    
+    void initAttachments()
+    {
+        std::vector<int> edges, edgeFaces, hinges, hingeFaces;
+        faceEdges(edges, edgeFaces, hinges, hingeFaces);
+        attachments.build(restPositions(), edges, edgeFaces, hinges, hingeFaces, (int)faceIndices.size() / 3, nodes);
+    }
+    
+    void initMembrane()
+    {
+        membrane.build(restPositions(), faceIndices, faceColors);
+        LOG_INFO("Membrane: %d elements in %d colors\n", membrane.elementCount(), (int)membrane.colorStart.size() - 1);
+    }
+    
+    /** Forces of the models that replace springs **/
+    void applyModelForces()
+    {
+        if (stretchModel != STRETCH_SPRINGS) {
+            membrane.tearStretch = tearStretch;
+            membrane.apply(nodes);
+        }
+        if (bendingModel == BENDING_ISOMETRIC) isometric.apply(nodes);
+    }
+    
+    /** Topology cache, see Topology.h: only for the untouched springs and faces of init() **/
+    TopologyKey topologyKey(NodeOrderEnum order) const
+    {
+        return TopologyKey(sizeof(T), nodesPerRow, nodesPerCol, nodesDensity, order, blockSize);
+    }
+    bool pristineTopology() const
+    {
+        return tearCount == 0 && springs.size() == firstSpring(nodesPerRow, 0);
+    }
+    bool loadTopology(NodeOrderEnum order)
+    {
+        if (!topologyCache.enabled() || !pristineTopology()) return false;
+        return topologyCache.load(topologyKey(order), [&](TopologyReader& r) { return readTopology(r); });
+    }
+    void saveTopology(NodeOrderEnum order) const
+    {
+        if (!topologyCache.enabled() || !pristineTopology()) return;
+        topologyCache.save(topologyKey(order), [&](TopologyWriter& w) { writeTopology(w); });
+    }
+    
+    /** Node and spring order as slots of the arena arrays, faces, colors, faces of nodes and springs, blocks **/
+    void writeTopology(TopologyWriter& w) const
+    {
+        std::vector<int> nodeSlots(nodes.size()), springSlots(springs.size());
+        for (int i = 0; i < nodes.size(); i ++) { nodeSlots[i] = (int)(nodes[i] - nodeBlock); }
+        for (int i = 0; i < springs.size(); i ++) { springSlots[i] = (int)(springs[i] - springBlock); }
+        w.section(nodeSlots);
+        w.section(springSlots);
+        w.section(faceIndices);
+        w.section(gridNodes);
+        w.section(springColor);
+        w.section(springColorPos);
+        w.section(faceColor);
+        w.section(faceColorPos);
+        w.section(nodeFaceStart);
+        w.section(nodeFaceCount);
+        w.section(nodeFaces);
+        w.section(springFaces);
+        
+        /** Blocks as offsets into flat lists **/
+        std::vector<int> nodeStart(1, 0), blockNodes, springStart(1, 0), blockSprings, borderStart(1, 0), border;
+        for (int b = 0; b < blocks.size(); b ++) {
+            blockNodes.insert(blockNodes.end(), blocks[b].nodes.begin(), blocks[b].nodes.end());
+            blockSprings.insert(blockSprings.end(), blocks[b].springs.begin(), blocks[b].springs.end());
+            for (int i = 0; i < blocks[b].border.size(); i ++) {
+                const ClothBorderSpring& s = blocks[b].border[i];
+                int fields[4] = { s.spring, s.halo1, s.halo2, s.inside1 };
+                border.insert(border.end(), fields, fields + 4);
+            }
+            nodeStart.push_back((int)blockNodes.size());
+            springStart.push_back((int)blockSprings.size());
+            borderStart.push_back((int)border.size() / 4);
+        }
+        w.section(nodeStart);
+        w.section(blockNodes);
+        w.section(springStart);
+        w.section(blockSprings);
+        w.section(borderStart);
+        w.section(border);
+        w.section(haloNodes);
+    }
+    
+    /** The cloth is only changed once every section has been read and checked **/
+    bool readTopology(TopologyReader& r)
+    {
+        int nodeCount = (int)nodes.size(), springCount = (int)springs.size(), faceCount = (int)faceIndices.size() / 3;
+        int blockCount = ((nodesPerRow + blockSize - 1) / blockSize) * ((nodesPerCol + blockSize - 1) / blockSize);
+        const int* nodeSlots = r.next(nodeCount);
+        const int* springSlots = r.next(springCount);
+        std::vector<int> newFaceIndices, newGridNodes, newSpringColor, newSpringColorPos, newFaceColor, newFaceColorPos;
+        std::vector<int> newNodeFaceStart, newNodeFaceCount, newNodeFaces, newSpringFaces;
+        std::vector<int> nodeStart, blockNodes, springStart, blockSprings, borderStart, border, newHaloNodes;
+        r.into(newFaceIndices, 3*faceCount);
+        r.into(newGridNodes, nodeCount);
+        r.into(newSpringColor, springCount);
+        r.into(newSpringColorPos, springCount);
+        r.into(newFaceColor, faceCount);
+        r.into(newFaceColorPos, faceCount);
+        r.into(newNodeFaceStart, nodeCount + 1);
+        r.into(newNodeFaceCount, nodeCount);
+        r.into(newNodeFaces);
+        r.into(newSpringFaces, 2*springCount);
+        r.into(nodeStart, blockCount + 1);
+        r.into(blockNodes, nodeCount);
+        r.into(springStart, blockCount + 1);
+        r.into(blockSprings);
+        r.into(borderStart, blockCount + 1);
+        r.into(border);
+        r.into(newHaloNodes);
+        if (!r.ok) return false;
+        
+        /** Every value is an index, out of range ones would corrupt memory later **/
+        if (!TopologyReader::permutation(nodeSlots, nodeCount) || !TopologyReader::permutation(springSlots, springCount)) return false;
+        if (!TopologyReader::inRange(newFaceIndices, 0, nodeCount) || !TopologyReader::inRange(newGridNodes, 0, nodeCount)) return false;
+        if (!TopologyReader::inRange(newNodeFaces, 0, faceCount) || !TopologyReader::inRange(newSpringFaces, -1, faceCount)) return false;
+        if (!TopologyReader::inRange(newNodeFaceCount, 0, faceCount + 1) || !TopologyReader::offsets(newNodeFaceStart, (int)newNodeFaces.size())) return false;
+        for (int i = 0; i < nodeCount; i ++) {
+            if (newNodeFaceStart[i] + newNodeFaceCount[i] > newNodeFaceStart[i+1]) return false;
+        }
+        if (!TopologyReader::inRange(blockNodes, 0, nodeCount) || !TopologyReader::inRange(blockSprings, 0, springCount) || !TopologyReader::inRange(newHaloNodes, 0, nodeCount)) return false;
+        if (border.size() % 4 != 0 || !TopologyReader::offsets(nodeStart, (int)blockNodes.size()) || !TopologyReader::offsets(springStart, (int)blockSprings.size()) || !TopologyReader::offsets(borderStart, (int)border.size() / 4)) return false;
+        for (int i = 0; i < border.size(); i += 4) {
+            if (border[i] < 0 || border[i] >= springCount || border[i+1] < 0 || border[i+1] >= newHaloNodes.size() || border[i+2] < 0 || border[i+2] >= newHaloNodes.size()) return false;
+        }
+        std::vector< std::vector<int> > newSpringColors, newFaceColors;
+        if (!fillBuckets(newSpringColors, newSpringColor, newSpringColorPos) || !fillBuckets(newFaceColors, newFaceColor, newFaceColorPos)) return false;
+        
+        /** Node and spring order **/
+        for (int i = 0; i < nodeCount; i ++) { nodes[i] = nodeBlock + nodeSlots[i]; }
+        for (int i = 0; i < springCount; i ++) { springs[i] = springBlock + springSlots[i]; }
+        faceIndices.swap(newFaceIndices);
+        for (int i = 0; i < faceIndices.size(); i ++) { faces[i] = nodes[faceIndices[i]]; }
+        gridNodes.swap(newGridNodes);
+        
+        /** Colors **/
+        springColors.swap(newSpringColors);
+        faceColors.swap(newFaceColors);
+        springColor.swap(newSpringColor);
+        springColorPos.swap(newSpringColorPos);
+        faceColor.swap(newFaceColor);
+        faceColorPos.swap(newFaceColorPos);
+        
+        /** Faces of nodes and springs, as initNodeFaces **/
+        nodeFaceStart.swap(newNodeFaceStart);
+        nodeFaceCount.swap(newNodeFaceCount);
+        nodeFaces.swap(newNodeFaces);
+        springFaces.swap(newSpringFaces);
+        faceNormals.assign(faceCount, Vec3());
+        faceWind.assign(faceCount, Vec3());
+        faceForce.assign(faceCount, Vec3());
+        nodeAero.assign(nodeCount, Vec3());
+        
+        /** Blocks, as initBlocks **/
+        blocksPerRow = (nodesPerRow + blockSize - 1) / blockSize;
+        blocksPerCol = (nodesPerCol + blockSize - 1) / blockSize;
+        blocks.assign(blockCount, ClothBlock());
+        for (int b = 0; b < blockCount; b ++) {
+            blocks[b].nodes.assign(blockNodes.begin() + nodeStart[b], blockNodes.begin() + nodeStart[b+1]);
+            blocks[b].springs.assign(blockSprings.begin() + springStart[b], blockSprings.begin() + springStart[b+1]);
+            for (int i = borderStart[b]; i < borderStart[b+1]; i ++) {
+                ClothBorderSpring s = { border[4*i], border[4*i+1], border[4*i+2], border[4*i+3] != 0 };
+                blocks[b].border.push_back(s);
+            }
+        }
+        haloNodes.swap(newHaloNodes);
+        haloPosition.resize(haloNodes.size());
+        haloVelocity.resize(haloNodes.size());
+        return true;
+    }
+    
+    /** Color buckets from the color and place of every item, false unless that fills every bucket exactly once **/
+    static bool fillBuckets(std::vector< std::vector<int> >& buckets, const std::vector<int>& bucketOf, const std::vector<int>& position)
+    {
+        int count = 0;
+        for (int i = 0; i < bucketOf.size(); i ++) {
+            if (bucketOf[i] < -1 || bucketOf[i] >= 64) return false; // Colors are bits of a 64 bit mask
+            count = std::max(count, bucketOf[i] + 1);
+        }
+        std::vector<int> sizes(count, 0);
+        for (int i = 0; i < bucketOf.size(); i ++) {
+            if (bucketOf[i] >= 0) sizes[bucketOf[i]] ++;
+        }
+        buckets.assign(count, std::vector<int>());
+        for (int c = 0; c < count; c ++) { buckets[c].assign(sizes[c], -1); }
+        for (int i = 0; i < bucketOf.size(); i ++) {
+            if (bucketOf[i] < 0) continue;
+            std::vector<int>& bucket = buckets[bucketOf[i]];
+            if (position[i] < 0 || position[i] >= bucket.size() || bucket[position[i]] >= 0) return false;
+            bucket[position[i]] = i;
+        }
+        return true;
+    }
+    
+    void initTiles()
+    {
+        tilesPerRow = (nodesPerRow + tileSize - 1) / tileSize;
+        tilesPerCol = (nodesPerCol + tileSize - 1) / tileSize;
+        tiles.assign(tilesPerRow*tilesPerCol, ClothTile());
+        nodeTile.resize(nodes.size());
+        for (int y = 0; y < tilesPerCol; y ++) {
+            for (int x = 0; x < tilesPerRow; x ++) {
+                tiles[y*tilesPerRow+x].tileX = x;
+                tiles[y*tilesPerRow+x].tileY = y;
+            }
+        }
+        for (int y = 0; y < nodesPerCol; y ++) {
+            for (int x = 0; x < nodesPerRow; x ++) {
+                int t = (y / tileSize) * tilesPerRow + x / tileSize;
+                nodeTile[gridNode(x, y)] = t;
+                tiles[t].nodes.push_back(gridNode(x, y));
+            }
+        }
+        for (int t = 0; t < tiles.size(); t ++) { // Memory order
+            std::sort(tiles[t].nodes.begin(), tiles[t].nodes.end());
+        }
+    }
+    
+    void initNodeFaces()
+    {
+        int faceCount = (int)faceIndices.size() / 3;
+        nodeFaceStart.assign(nodes.size() + 1, 0);
+        for (int i = 0; i < faceIndices.size(); i ++) { nodeFaceStart[faceIndices[i] + 1] ++; }
+        for (int i = 0; i < nodes.size(); i ++) { nodeFaceStart[i + 1] += nodeFaceStart[i]; }
+        nodeFaces.resize(faceIndices.size());
+        nodeFaceCount.assign(nodes.size(), 0);
+        for (int i = 0; i < faceIndices.size(); i ++) {
+            int n = faceIndices[i];
+            if (!faceRemoved(i / 3)) nodeFaces[nodeFaceStart[n] + nodeFaceCount[n] ++] = i / 3;
+        }
+        faceNormals.assign(faceCount, Vec3());
+        faceWind.assign(faceCount, Vec3());
+        faceForce.assign(faceCount, Vec3());
+        nodeAero.assign(nodes.size(), Vec3());
+        
+        /** Faces on the edge of each spring, bending springs span no face **/
+        // Springs are bucketed by their lower node, the spring of an edge is then among the few of its lower node
+        NodeIndex index = nodeIndices();
+        std::vector<int> springLow(springs.size(), -1), springHigh(springs.size(), -1);
+        std::vector<int> lowStart(nodes.size() + 1, 0);
+        for (int i = 0; i < springs.size(); i ++) {
+            if (springs[i]->isTorn) continue;
+            int a = index[springs[i]->node1], b = index[springs[i]->node2];
+            springLow[i] = std::min(a, b);
+            springHigh[i] = std::max(a, b);
+            lowStart[springLow[i] + 1] ++;
+        }
+        for (int i = 0; i < nodes.size(); i ++) { lowStart[i + 1] += lowStart[i]; }
+        std::vector<int> lowSprings(lowStart.back());
+        std::vector<int> lowFill(lowStart.begin(), lowStart.end() - 1);
+        for (int i = 0; i < springs.size(); i ++) {
+            if (springLow[i] >= 0) lowSprings[lowFill[springLow[i]] ++] = i;
+        }
+        springFaces.assign(2*springs.size(), -1);
+        for (int f = 0; f < faceCount; f ++) {
+            if (faceRemoved(f)) continue;
+            for (int k = 0; k < 3; k ++) {
+                int a = faceIndices[3*f+k], b = faceIndices[3*f+(k+1)%3];
+                int low = std::min(a, b), high = std::max(a, b);
+                int edge = -1;
+                for (int s = lowStart[low]; s < lowStart[low + 1]; s ++) {
+                    if (springHigh[lowSprings[s]] == high) edge = lowSprings[s]; // The last one, should an edge have two
+                }
+                if (edge < 0) continue;
+                int* slot = &springFaces[2*edge];
+                slot[slot[0] < 0 ? 0 : 1] = f;
+            }
+        }
+    }
+    
+    void initBlocks()
+    {
+        blocksPerRow = (nodesPerRow + blockSize - 1) / blockSize;
+        blocksPerCol = (nodesPerCol + blockSize - 1) / blockSize;
+        blocks.assign(blocksPerRow*blocksPerCol, ClothBlock());
+        std::vector<int> nodeBlock(nodes.size());
+        for (int y = 0; y < nodesPerCol; y ++) {
+            for (int x = 0; x < nodesPerRow; x ++) {
+                int b = (y / blockSize) * blocksPerRow + x / blockSize;
+                nodeBlock[gridNode(x, y)] = b;
+                blocks[b].nodes.push_back(gridNode(x, y));
+            }
+        }
+        for (int b = 0; b < blocks.size(); b ++) {
+            std::sort(blocks[b].nodes.begin(), blocks[b].nodes.end());
+        }
+        
+        NodeIndex index = nodeIndices();
+        std::vector<int> haloSlot(nodes.size(), -1);
+        haloNodes.clear();
+        for (int i = 0; i < springs.size(); i ++) {
+            int n1 = index[springs[i]->node1], n2 = index[springs[i]->node2];
+            if (nodeBlock[n1] == nodeBlock[n2]) {
+                blocks[nodeBlock[n1]].springs.push_back(i);
+                continue;
+            }
+            int ends[2] = { n1, n2 };
+            for (int k = 0; k < 2; k ++) {
+                if (haloSlot[ends[k]] >= 0) continue;
+                haloSlot[ends[k]] = (int)haloNodes.size();
+                haloNodes.push_back(ends[k]);
+            }
+            ClothBorderSpring s = { i, haloSlot[n1], haloSlot[n2], true };
+            blocks[nodeBlock[n1]].border.push_back(s);
+            s.inside1 = false;
+            blocks[nodeBlock[n2]].border.push_back(s);
+        }
+        haloPosition.resize(haloNodes.size());
+        haloVelocity.resize(haloNodes.size());
+    }
 	
 	void computeNormal()
 	{
-        /** Reset nodes' normal **/
-        Vec3 normal(0.0, 0.0, 0.0);
-        for (int i = 0; i < nodes.size(); i ++) {
-            nodes[i]->normal = normal;
+        if (sleepingTiles > 0) {
+            computeAwakeNormal();
+            return;
         }
+        /** Reset nodes' normal **/
+        parallelFor(0, (int)nodes.size(), [&](int i) { nodes[i]->normal.setZeroVec(); });
         /** Compute normal of each face **/
-        for (int i = 0; i < faces.size()/3; i ++) { // 3 nodes in each face
-            Node* n1 = faces[3*i+0];
-            Node* n2 = faces[3*i+1];
-            Node* n3 = faces[3*i+2];
-            
-            // Face normal
-            normal = computeFaceNormal(n1, n2, n3);
-            // Add all face normal
-            n1->normal += normal;
-            n2->normal += normal;
-            n3->normal += normal;
-        }
-        
-        for (int i = 0; i < nodes.size(); i ++) {
-            nodes[i]->normal.normalize();
+        if (threadPool.size() == 1) {
+            for (int i = 0; i < faces.size()/3; i ++) { // 3 nodes in each face
+                addFaceNormal(i);
+            }
+        } else {
+            for (int c = 0; c < faceColors.size(); c ++) {
+                std::vector<int>& color = faceColors[c];
+                parallelFor(0, (int)color.size(), [&](int i) { addFaceNormal(color[i]); });
+            }
         }
+        
+        parallelFor(0, (int)nodes.size(), [&](int i) { nodes[i]->normal.normalize(); });
 	}
+    
+    /** Only nodes whose tile or a neighbouring tile is awake, faces touching none of them are skipped **/
+    void computeAwakeNormal()
+    {
+        parallelFor(0, (int)nodes.size(), [&](int i) { if (!normalFrozen(i)) nodes[i]->normal.setZeroVec(); });
+        if (threadPool.size() == 1) {
+            for (int i = 0; i < faces.size()/3; i ++) { addAwakeFaceNormal(i); }
+        } else {
+            for (int c = 0; c < faceColors.size(); c ++) {
+                std::vector<int>& color = faceColors[c];
+                parallelFor(0, (int)color.size(), [&](int i) { addAwakeFaceNormal(color[i]); });
+            }
+        }
+        parallelFor(0, (int)nodes.size(), [&](int i) { if (!normalFrozen(i)) nodes[i]->normal.normalize(); });
+    }
+    
+    bool normalFrozen(int node) { return tiles[nodeTile[node]].normalsFrozen; }
+    
+    void addAwakeFaceNormal(int face)
+    {
+        Node** n = &faces[3*face];
+        bool frozen[3];
+        for (int k = 0; k < 3; k ++) { frozen[k] = normalFrozen(faceIndices[3*face+k]); }
+        if (frozen[0] && frozen[1] && frozen[2]) return;
+        Vec3 normal = computeFaceNormal(n[0], n[1], n[2]);
+        faceNormals[face] = normal;
+        for (int k = 0; k < 3; k ++) {
+            if (!frozen[k]) n[k]->normal += normal;
+        }
+    }
+    
+    void addFaceNormal(int face)
+    {
+        Node* n1 = faces[3*face+0];
+        Node* n2 = faces[3*face+1];
+        Node* n3 = faces[3*face+2];
+        
+        // Face normal
+        Vec3 normal = computeFaceNormal(n1, n2, n3);
+        faceNormals[face] = normal;
+        // Add all face normal
+        n1->normal += normal;
+        n2->normal += normal;
+        n3->normal += normal;
+    }
 	
-	void addForce(Vec3 f)
+	void addForce(const Vec3& f)
 	{		 
 		for (int i = 0; i < nodes.size(); i++)
 		{
 			nodes[i]->addForce(f);
 		}
+        wakeAll();
 	}
 
-	void computeForce(double timeStep, Vec3 gravity)
+	void computeForce(double timeStep, const Vec3& gravity, bool aero = false) // With the held nodeAero
 	{
         /** Nodes **/
-		for (int i = 0; i < nodes.size(); i++)
-		{
-			nodes[i]->addForce(gravity * nodes[i]->mass);
-		}
+        parallelFor(0, (int)nodes.size(), [&](int i) { addNodeForce(i, gravity, aero); });
 		/** Springs **/
-		for (int i = 0; i < springs.size(); i++)
-		{
-			springs[i]->applyInternalForce(timeStep);
-		}
+        applySpringForces(timeStep);
+        applyModelForces();
 	}
+    
+    void applySpringForces(double timeStep)
+    {
+        if (threadPool.size() == 1) {
+            for (int i = 0; i < springs.size(); i++)
+            {
+                if (springs[i]->isActive()) checkStretch(i, springs[i]->applyInternalForce(timeStep));
+            }
+            return;
+        }
+        for (int c = 0; c < springColors.size(); c ++) {
+            std::vector<int>& color = springColors[c];
+            parallelFor(0, (int)color.size(), [&](int i) {
+                Spring* s = springs[color[i]];
+                if (s->isActive()) checkStretch(color[i], s->applyInternalForce(timeStep));
+            });
+        }
+    }
+    
+    /** Tearing **/
+    void checkStretch(int s, T currLen)
+    {
+        if (tearStretch <= 0.0 || currLen <= tearStretch * springs[s]->restLen) return;
+        if (springs[s]->node1->isFixed || springs[s]->node2->isFixed) return; // Pins are offset at init, their springs start stretched
+        std::lock_guard<std::mutex> lock(tearLock); // Rare, only when a spring actually breaks
+        pendingTears.push_back(s);
+    }
+    
+    /** After the substep that found them, so every spring saw the same topology **/
+    void applyTears()
+    {
+        std::vector<int>& faceTears = membrane.tornFaces; // Overstretched membrane elements take only their face
+        std::sort(faceTears.begin(), faceTears.end());
+        for (int i = 0; i < faceTears.size(); i ++) { removeFace(faceTears[i]); }
+        std::sort(pendingTears.begin(), pendingTears.end()); // Same result whichever thread found them first
+        for (int i = 0; i < pendingTears.size(); i ++) { tearSpring(pendingTears[i]); }
+        attachments.repair(); // Paths around the faces removed above
+        faceTears.clear();
+        pendingTears.clear();
+    }
+    
+    void tearSpring(int s)
+    {
+        Spring* spring = springs[s];
+        if (spring->isTorn) return;
+        spring->isTorn = true;
+        removeFromBucket(springColors, springColor, springColorPos, s);
+        tearCount ++;
+        for (int k = 0; k < 2; k ++) {
+            if (springFaces[2*s+k] >= 0) removeFace(springFaces[2*s+k]);
+        }
+    }
+    
+    /** The face collapses onto its first node: no normal, no aerodynamic force, nothing drawn **/
+    void removeFace(int f)
+    {
+        if (faceRemoved(f)) return;
+        for (int k = 0; k < 3; k ++) { // Out of the face lists of its nodes
+            int n = faceIndices[3*f+k];
+            int* list = &nodeFaces[nodeFaceStart[n]];
+            int* end = list + nodeFaceCount[n];
+            int* entry = std::find(list, end, f);
+            if (entry == end) continue;
+            *entry = *(end-1);
+            nodeFaceCount[n] --;
+        }
+        removeFromBucket(faceColors, faceColor, faceColorPos, f);
+        isometric.removeFace(f);
+        membrane.removeFace(f);
+        attachments.removeFace(f);
+        for (int k = 1; k < 3; k ++) {
+            faceIndices[3*f+k] = faceIndices[3*f];
+            faces[3*f+k] = faces[3*f];
+        }
+        faceNormals[f].setZeroVec();
+        faceForce[f].setZeroVec();
+        tearCount ++;
+        faceEdits.push_back(f);
+    }
 
-	void integrate(double airFriction, double timeStep)
+	void integrate(double timeStep)
 	{
         /** Node **/
-        for (int i = 0; i < nodes.size(); i++)
-        {
-            nodes[i]->integrate(timeStep);
-        }
+        parallelFor(0, (int)nodes.size(), [&](int i) { integrateNode(i, timeStep); });
 	}
+    
+    /** Once per frame: wind at every face centre, sleeping tiles wake when the wind over them changed **/
+    void sampleWind(const WindField& field, const Vec3T<double>& mean, double time)
+    {
+        parallelFor(0, (int)faceWind.size(), [&](int f) {
+            Vec3T<double> centre = (getWorldPos(faces[3*f]) + getWorldPos(faces[3*f+1]) + getWorldPos(faces[3*f+2])) / 3.0;
+            faceWind[f] = field.sample(mean, centre, time);
+        });
+        for (int t = 0; t < tiles.size(); t ++) {
+            ClothTile& tile = tiles[t];
+            tile.wind = field.sample(mean, getWorldPos(nodes[tile.nodes[0]]), time);
+            if (tile.asleep && (tile.wind - tile.restWind).length() > wakeWind) wakeTile(t);
+        }
+        updateFrozenNormals();
+    }
+    
+    /** Drag and lift of every face from its velocity relative to the wind, spread over its nodes **/
+    // Per face of area A, unit normal n, relative velocity v and cos = n.v / |v|:
+    //   drag = -1/2 rho A Cd |cos| |v|^2 v / |v|,   lift = -1/2 rho A Cl cos |v|^2 (n - cos v / |v|)
+    // With the area weighted normal N = 2 A n both only need |v| and |N|. Two passes so no two threads write
+    // the same node: contiguous per-face arithmetic, then every node gathers its faces into nodeAero.
+    void updateAerodynamics(double density, double dragCoef, double liftCoef)
+    {
+        const T k = density / 4.0;
+        const T drag = k * dragCoef, lift = k * liftCoef;
+        parallelFor(0, (int)faceForce.size(), [&](int f) {
+            Node* n1 = faces[3*f];
+            Node* n2 = faces[3*f+1];
+            Node* n3 = faces[3*f+2];
+            Vec3 v = (n1->velocity + n2->velocity + n3->velocity) * (T)(1.0/3.0) - faceWind[f];
+            const Vec3& N = faceNormals[f];
+            T vn = Vec3::dot(N, v);
+            T v2 = v.lengthSquared();
+            T nl2 = N.lengthSquared();
+            if (v2 < 1e-12 || nl2 < 1e-18) {
+                faceForce[f].setZeroVec();
+                return;
+            }
+            T speed = sqrt(v2), nl = sqrt(nl2);
+            Vec3 force = v * (-drag * fabs(vn));
+            force.axpy(-lift * vn * speed / nl, N);
+            force.axpy(lift * vn * vn / (nl * speed), v);
+            faceForce[f] = force * (T)(1.0/3.0);
+        });
+        parallelFor(0, (int)nodes.size(), [&](int i) {
+            Vec3 sum;
+            for (int j = nodeFaceStart[i]; j < nodeFaceStart[i] + nodeFaceCount[i]; j ++) { sum += faceForce[nodeFaces[j]]; }
+            nodeAero[i] = sum;
+        });
+    }
+    
+    /** Gravity and the held aerodynamic force, in the same pass over the nodes **/
+    void addNodeForce(int i, const Vec3& gravity, bool aero)
+    {
+        Node* n = nodes[i];
+        if (n->isAsleep) return;
+        n->force.axpy(n->mass, gravity);
+        if (aero) n->force += nodeAero[i];
+    }
+    
+    void integrateNode(int i, double timeStep)
+    {
+        if (nodes[i]->isAsleep) nodes[i]->force.setZeroVec(); // Pulls from awake neighbours are dropped
+        else nodes[i]->integrate(timeStep);
+        if (attachments.active() && !nodes[i]->isAsleep) attachments.constrain(nodes, i);
+    }
+    
+    /** The three substep passes fused per block, so a block stays in cache from force to collision **/
+    // Springs crossing a block border read both ends from a halo copied before any block moves, so blocks are
+    // independent and the result matches computeForce + integrate + collisionResponse up to summation order.
+    void blockedSubstep(double timeStep, const Vec3& gravity, Ground* ground, Ball* ball, bool aero = false)
+    {
+        applyModelForces(); // Reads positions no block has moved yet
+        parallelFor(0, (int)haloNodes.size(), [&](int h) {
+            haloPosition[h] = nodes[haloNodes[h]]->position;
+            haloVelocity[h] = nodes[haloNodes[h]]->velocity;
+        });
+        if (threadPool.size() == 1) {
+            for (int b = 0; b < blocks.size(); b ++) { runBlock(blocks[b], timeStep, gravity, ground, ball, aero); }
+        } else {
+            threadPool.run(0, (int)blocks.size(), 1, [&](int begin, int end) {
+                for (int b = begin; b < end; b ++) { runBlock(blocks[b], timeStep, gravity, ground, ball, aero); }
+            });
+        }
+    }
+    
+    void runBlock(const ClothBlock& block, double timeStep, const Vec3& gravity, Ground* ground, Ball* ball, bool aero)
+    {
+        for (int i = 0; i < block.nodes.size(); i ++) { addNodeForce(block.nodes[i], gravity, aero); }
+        for (int i = 0; i < block.springs.size(); i ++) {
+            Spring* s = springs[block.springs[i]];
+            if (s->isActive()) checkStretch(block.springs[i], s->applyInternalForce(timeStep));
+        }
+        for (int i = 0; i < block.border.size(); i ++) {
+            const ClothBorderSpring& b = block.border[i];
+            Spring* s = springs[b.spring];
+            if (!s->isActive()) continue;
+            Vec3 dir;
+            T len;
+            T f = s->tension(haloPosition[b.halo1], haloVelocity[b.halo1], haloPosition[b.halo2], haloVelocity[b.halo2], dir, len);
+            if (b.inside1) {
+                s->node1->force.axpy(f, dir);
+                checkStretch(b.spring, len); // Once, from the block of node1
+            } else {
+                s->node2->force.axpy(-f, dir);
+            }
+        }
+        for (int i = 0; i < block.nodes.size(); i ++) { integrateNode(block.nodes[i], timeStep); }
+        for (int i = 0; i < block.nodes.size(); i ++) { collideNode(block.nodes[i], ground, ball); }
+    }
 	
-    Vec3 getWorldPos(Node* n) { return clothPos + n->position; }
-    void setWorldPos(Node* n, Vec3 pos) { n->position = pos - clothPos; }
+    /** Sleeping **/
+    void wakeTile(int t)
+    {
+        ClothTile& tile = tiles[t];
+        tile.quietSubsteps = 0;
+        if (!tile.asleep) return;
+        tile.asleep = false;
+        sleepingTiles --;
+        for (int i = 0; i < tile.nodes.size(); i ++) { nodes[tile.nodes[i]]->isAsleep = false; }
+    }
+    void wakeAll()
+    {
+        for (int t = 0; t < tiles.size(); t ++) { wakeTile(t); }
+        updateFrozenNormals();
+    }
     
-	void collisionResponse(Ground* ground, Ball* ball)
-	{
-        for (int i = 0; i < nodes.size(); i++)
-        {
-            /** Ground collision **/
-            if (getWorldPos(nodes[i]).y < ground->position.y) {
-                nodes[i]->position.y = ground->position.y - clothPos.y + 0.01;
-                nodes[i]->velocity = nodes[i]->velocity * ground->friction;
-            }
-            
-            /** Ball collision **/
-            Vec3 distVec = getWorldPos(nodes[i]) - ball->center;
-            double distLen = distVec.length();
-            double safeDist = ball->radius*1.05;
-            if (distLen < safeDist) {
-                distVec.normalize();
-                setWorldPos(nodes[i], distVec*safeDist+ball->center);
-                nodes[i]->velocity = nodes[i]->velocity*ball->friction;
+    void sleepTile(int t)
+    {
+        ClothTile& tile = tiles[t];
+        tile.asleep = true;
+        tile.restWind = tile.wind;
+        sleepingTiles ++;
+        for (int i = 0; i < tile.nodes.size(); i ++) {
+            Node* n = nodes[tile.nodes[i]];
+            n->isAsleep = true;
+            n->velocity.setZeroVec();
+        }
+    }
+    
+    /** After each substep: quiet tiles fall asleep, motion nearby or a moving collider wakes them **/
+    void updateSleep(Ball* ball)
+    {
+        parallelFor(0, (int)tiles.size(), [&](int t) {
+            ClothTile& tile = tiles[t];
+            tile.maxEnergy = 0.0;
+            if (tile.asleep) return;
+            for (int i = 0; i < tile.nodes.size(); i ++) {
+                Node* n = nodes[tile.nodes[i]];
+                tile.maxEnergy = std::max(tile.maxEnergy, 0.5 * n->mass * n->velocity.lengthSquared());
+            }
+        });
+        
+        bool ballMoved = (ball->center - lastBallCenter).length() > 1e-9;
+        lastBallCenter = ball->center;
+        for (int t = 0; t < tiles.size(); t ++) {
+            ClothTile& tile = tiles[t];
+            if (tile.asleep) {
+                if (ballMoved && nearBall(tile, ball)) wakeTile(t);
+                continue;
+            }
+            if (tile.maxEnergy > wakeEnergy) {
+                wakeNeighbours(tile);
+            }
+            if (tile.maxEnergy < sleepEnergy) {
+                if (++tile.quietSubsteps >= sleepSubsteps) sleepTile(t);
+            } else {
+                tile.quietSubsteps = 0;
             }
         }
+        updateFrozenNormals();
+    }
+    
+    void wakeNeighbours(const ClothTile& tile)
+    {
+        for (int y = std::max(0, tile.tileY-1); y <= std::min(tilesPerCol-1, tile.tileY+1); y ++) {
+            for (int x = std::max(0, tile.tileX-1); x <= std::min(tilesPerRow-1, tile.tileX+1); x ++) {
+                wakeTile(y*tilesPerRow+x);
+            }
+        }
+    }
+    
+    bool nearBall(const ClothTile& tile, Ball* ball)
+    {
+        double reach = ball->radius*1.05 + wakeMargin;
+        for (int i = 0; i < tile.nodes.size(); i ++) {
+            if ((getWorldPos(nodes[tile.nodes[i]]) - ball->center).length() < reach) return true;
+        }
+        return false;
+    }
+    
+    void updateFrozenNormals()
+    {
+        for (int t = 0; t < tiles.size(); t ++) {
+            ClothTile& tile = tiles[t];
+            tile.normalsFrozen = tile.asleep;
+            for (int y = std::max(0, tile.tileY-1); tile.normalsFrozen && y <= std::min(tilesPerCol-1, tile.tileY+1); y ++) {
+                for (int x = std::max(0, tile.tileX-1); x <= std::min(tilesPerRow-1, tile.tileX+1); x ++) {
+                    if (!tiles[y*tilesPerRow+x].asleep) tile.normalsFrozen = false;
+                }
+            }
+        }
+    }
+    
+    Vec3 getWorldPos(const Node* n) const { return clothPos + n->position; }
+    void setWorldPos(Node* n, const Vec3& pos) const { n->position = pos - clothPos; }
+    
+	void collisionResponse(Ground* ground, Ball* ball)
+	{
+        parallelFor(0, (int)nodes.size(), [&](int i) { collideNode(i, ground, ball); });
 	}
+    
+    void collideNode(int i, Ground* ground, Ball* ball)
+    {
+        if (nodes[i]->isAsleep) return;
+        /** Ground collision **/
+        double groundSkin = 0.01;
+        if (getWorldPos(nodes[i]).y < ground->position.y + groundSkin) {
+            nodes[i]->position.y = ground->position.y - clothPos.y + groundSkin;
+            nodes[i]->velocity.y = std::max(nodes[i]->velocity.y, (T)0.0); // No speed into the ground is kept
+            nodes[i]->velocity = nodes[i]->velocity * ground->friction;
+        }
+        
+        /** Ball collision **/
+        Vec3 distVec = getWorldPos(nodes[i]) - ball->center;
+        T distLen = distVec.length();
+        double safeDist = ball->radius*1.05;
+        if (distLen < safeDist) {
+            distVec.normalize();
+            setWorldPos(nodes[i], distVec*safeDist+ball->center);
+            T inward = Vec3::dot(nodes[i]->velocity, distVec);
+            if (inward < 0.0) nodes[i]->velocity.axpy(-inward, distVec);
+            nodes[i]->velocity = nodes[i]->velocity*ball->friction;
+        }
+    }
 };
+
+typedef ClothT<Scalar> Cloth;
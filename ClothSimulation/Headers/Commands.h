@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+
+#include "Vectors.h"
+
+/** Mutation of the simulation requested by input, applied by the simulation between substeps **/
+struct SimCommand
+{
+    enum SimCommandEnum {
+        FORCE_IMPULSE,  // Push every node once by vec, impulses of one drain are summed
+        SET_WIND,       // Mean wind until set again, the last one wins, see Simulation::wind
+        PIN,            // Fix the node at grid index where it is
+        UNPIN,          // Release the node at grid index
+        PAUSE,
+        RESUME,
+        SET_TEARING     // Tear stretch of the cloth in vec.x, 0 stops tearing
+    };
+    SimCommandEnum type;
+    Vec3 vec;
+    Vec2 index;
+
+    static SimCommand make(SimCommandEnum t, const Vec3& v = Vec3(), const Vec2& i = Vec2())
+    {
+        SimCommand c;
+        c.type = t;
+        c.vec = v;
+        c.index = i;
+        return c;
+    }
+};
+
+/** Bounded lock-free queue, any number of producers and one consumer **/
+// Dmitry Vyukov's bounded queue: every cell carries a sequence number telling producers and the consumer
+// whose turn it is, so a push is one compare-and-swap and a pop none. Capacity must be a power of two.
+template <typename T, int Capacity>
+struct CommandQueue
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "CommandQueue capacity must be a power of two");
+
+    struct Cell
+    {
+        std::atomic<unsigned> sequence;
+        T value;
+    };
+    Cell cells[Capacity];
+    alignas(64) std::atomic<unsigned> enqueuePos; // Shared by the producers
+    alignas(64) unsigned dequeuePos;              // Consumer only
+
+    CommandQueue()
+    {
+        for (unsigned i = 0; i < Capacity; i ++) { cells[i].sequence.store(i, std::memory_order_relaxed); }
+        enqueuePos.store(0, std::memory_order_relaxed);
+        dequeuePos = 0;
+    }
+
+    /** Returns false when the queue is full, the command is dropped then **/
+    bool push(const T& value)
+    {
+        unsigned pos = enqueuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &cells[pos & (Capacity - 1)];
+            unsigned sequence = cell->sequence.load(std::memory_order_acquire);
+            int diff = (int)(sequence - pos);
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false; // The consumer has not freed this cell yet
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Returns false when nothing is published yet **/
+    bool pop(T& value)
+    {
+        Cell* cell = &cells[dequeuePos & (Capacity - 1)];
+        if (cell->sequence.load(std::memory_order_acquire) != dequeuePos + 1) return false;
+        value = cell->value;
+        cell->sequence.store(dequeuePos + Capacity, std::memory_order_release);
+        dequeuePos ++;
+        return true;
+    }
+};
@@ -40,15 +40,22 @@ Light sun;
 struct ClothRender // Texture & Lighting
 {
     const Cloth* cloth;
-    int nodeCount; // Number of all nodes in faces
+    int nodeCount;  // One vertex per node, shared by its faces
+    int indexCount; // Three node indices per face
+    int uploadedEdits = 0; // Entries of cloth->faceEdits already in the index buffer
     
     glm::vec3 *vboPos; // Position
     glm::vec2 *vboTex; // Texture
     glm::vec3 *vboNor; // Normal
+    
+    /** Interpolation between the last two simulation ticks, see FixedStep **/
+    std::vector<glm::vec3> previous; // Positions before the last tick, empty draws the cloth as it is
+    float alpha = 1.0f;
 
     GLuint programID;
     GLuint vaoID;
     GLuint vboIDs[3];
+    GLuint eboID;
     GLuint texID;
     
     GLint aPtrPos;
@@ -57,9 +64,10 @@ struct ClothRender // Texture & Lighting
     
     ClothRender(Cloth* cloth)
     {
-        nodeCount = (int)(cloth->faces.size());
-        if (nodeCount <= 0) {
-            std::cout << "ERROR::ClothRender : No node exists." << std::endl;
+        nodeCount = (int)(cloth->nodes.size());
+        indexCount = (int)(cloth->faceIndices.size());
+        if (indexCount <= 0) {
+            LOG_ERROR("ClothRender : No node exists.\n");
             exit(-1);
         }
         
@@ -69,7 +77,7 @@ struct ClothRender // Texture & Lighting
         vboTex = new glm::vec2[nodeCount];
         vboNor = new glm::vec3[nodeCount];
         for (int i = 0; i < nodeCount; i ++) {
-            Node* n = cloth->faces[i];
+            Node* n = cloth->nodes[i];
             vboPos[i] = glm::vec3(n->position.x, n->position.y, n->position.z);
             vboTex[i] = glm::vec2(n->texCoord.x, n->texCoord.y); // Texture coord will only be set here
             vboNor[i] = glm::vec3(n->normal.x, n->normal.y, n->normal.z);
@@ -78,11 +86,12 @@ struct ClothRender // Texture & Lighting
         /** Build render program **/
         Program program("Shaders/ClothVS.glsl", "Shaders/ClothFS.glsl");
         programID = program.ID;
-        std::cout << "Cloth Program ID: " << programID << std::endl;
+        LOG_DEBUG("Cloth Program ID: %u\n", programID);
 
         // Generate ID of VAO and VBOs
         glGenVertexArrays(1, &vaoID);
         glGenBuffers(3, vboIDs);
+        glGenBuffers(1, &eboID);
         
         // Attribute pointers of VAO
         aPtrPos = 0;
@@ -103,6 +112,9 @@ struct ClothRender // Texture & Lighting
         glBindBuffer(GL_ARRAY_BUFFER, vboIDs[2]);
         glVertexAttribPointer(aPtrNor, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
         glBufferData(GL_ARRAY_BUFFER, nodeCount*sizeof(glm::vec3), vboNor, GL_DYNAMIC_DRAW);
+        // Index buffer, follows the node order of the cloth, only faces changed by tearing are uploaded again
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eboID);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount*sizeof(GLuint), &cloth->faceIndices[0], GL_STATIC_DRAW);
         
         // Enable it's attribute pointers since they were set well
         glEnableVertexAttribArray(aPtrPos);
@@ -128,7 +140,7 @@ struct ClothRender // Texture & Lighting
             // Automatically generate all the required mipmaps for the currently bound texture.
             glGenerateMipmap(GL_TEXTURE_2D);
         } else {
-            cout << "Failed to load texture" << endl;
+            LOG_ERROR("Failed to load texture\n");
         }
         // Always free image memory
         stbi_image_free(data);
@@ -166,6 +178,7 @@ struct ClothRender // Texture & Lighting
         {
             glDeleteVertexArrays(1, &vaoID);
             glDeleteBuffers(3, vboIDs);
+            glDeleteBuffers(1, &eboID);
             vaoID = 0;
         }
         if (programID)
@@ -175,14 +188,40 @@ struct ClothRender // Texture & Lighting
         }
     }
     
+    // CPU-side staging copy, kept free of GL calls so it can be benchmarked on its own
+    static void stage(const Cloth* cloth, glm::vec3* pos, glm::vec3* nor, int count)
+    {
+        parallelFor(0, count, [&](int i) { // Tex coordinate dose not change
+            Node* n = cloth->nodes[i];
+            pos[i] = glm::vec3(n->position.x, n->position.y, n->position.z);
+            nor[i] = glm::vec3(n->normal.x, n->normal.y, n->normal.z);
+        });
+    }
+    // Positions blended from before to the current ones, normals are the current ones (the shader normalizes them)
+    static void stage(const Cloth* cloth, const glm::vec3* before, float alpha, glm::vec3* pos, glm::vec3* nor, int count)
+    {
+        parallelFor(0, count, [&](int i) {
+            Node* n = cloth->nodes[i];
+            pos[i] = glm::mix(before[i], glm::vec3(n->position.x, n->position.y, n->position.z), alpha);
+            nor[i] = glm::vec3(n->normal.x, n->normal.y, n->normal.z);
+        });
+    }
+    
+    /** Call before the last tick of a frame, the state to blend from **/
+    void keepPrevious()
+    {
+        previous.resize(nodeCount);
+        parallelFor(0, nodeCount, [&](int i) {
+            Node* n = cloth->nodes[i];
+            previous[i] = glm::vec3(n->position.x, n->position.y, n->position.z);
+        });
+    }
+    
     void flush()
     {
         // Update all the positions of nodes
-        for (int i = 0; i < nodeCount; i ++) { // Tex coordinate dose not change
-            Node* n = cloth->faces[i];
-            vboPos[i] = glm::vec3(n->position.x, n->position.y, n->position.z);
-            vboNor[i] = glm::vec3(n->normal.x, n->normal.y, n->normal.z);
-        }
+        if (previous.empty() || alpha >= 1.0f) stage(cloth, vboPos, vboNor, nodeCount);
+        else stage(cloth, &previous[0], alpha, vboPos, vboNor, nodeCount);
         
         glUseProgram(programID);
         
@@ -194,6 +233,11 @@ struct ClothRender // Texture & Lighting
         glBufferSubData(GL_ARRAY_BUFFER, 0, nodeCount* sizeof(glm::vec2), vboTex);
         glBindBuffer(GL_ARRAY_BUFFER, vboIDs[2]);
         glBufferSubData(GL_ARRAY_BUFFER, 0, nodeCount* sizeof(glm::vec3), vboNor);
+        // Faces edited since the last frame, three indices each
+        for (; uploadedEdits < cloth->faceEdits.size(); uploadedEdits ++) {
+            int f = cloth->faceEdits[uploadedEdits];
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 3*f*sizeof(GLuint), 3*sizeof(GLuint), &cloth->faceIndices[3*f]);
+        }
         
         /** Bind texture **/
         glActiveTexture(GL_TEXTURE0);
@@ -212,10 +256,10 @@ struct ClothRender // Texture & Lighting
                 glDrawArrays(GL_POINTS, 0, nodeCount);
                 break;
             case Cloth::DRAW_LINES:
-                glDrawArrays(GL_LINES, 0, nodeCount);
+                glDrawElements(GL_LINES, indexCount, GL_UNSIGNED_INT, (void*)0);
                 break;
             default:
-                glDrawArrays(GL_TRIANGLES, 0, nodeCount);
+                glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, (void*)0);
                 break;
         }
         
@@ -250,7 +294,7 @@ struct SpringRender
         springs = s;
         springCount = (int)(springs.size());
         if (springCount <= 0) {
-            std::cout << "ERROR::SpringRender : No node exists." << std::endl;
+            LOG_ERROR("SpringRender : No node exists.\n");
             exit(-1);
         }
         
@@ -270,7 +314,7 @@ struct SpringRender
         /** Build render program **/
         Program program("Shaders/SpringVS.glsl", "Shaders/SpringFS.glsl");
         programID = program.ID;
-        std::cout << "Spring Program ID: " << programID << std::endl;
+        LOG_DEBUG("Spring Program ID: %u\n", programID);
 
         // Generate ID of VAO and VBOs
         glGenVertexArrays(1, &vaoID);
@@ -341,7 +385,7 @@ struct SpringRender
         // Update all the positions of nodes
         for (int i = 0; i < springCount; i ++) {
             Node* node1 = springs[i]->node1;
-            Node* node2 = springs[i]->node2;
+            Node* node2 = springs[i]->isTorn ? node1 : springs[i]->node2; // Torn springs collapse to a point
             vboPos[i*2] = glm::vec3(node1->position.x, node1->position.y, node1->position.z);
             vboPos[i*2+1] = glm::vec3(node2->position.x, node2->position.y, node2->position.z);
             vboNor[i*2] = glm::vec3(node1->normal.x, node1->normal.y, node1->normal.z);
@@ -414,7 +458,7 @@ struct RigidRender // Single color & Lighting
         faces = f;
         vertexCount = (int)(faces.size());
         if (vertexCount <= 0) {
-            std::cout << "ERROR::RigidRender : No vertex exists." << std::endl;
+            LOG_ERROR("RigidRender : No vertex exists.\n");
             exit(-1);
         }
         
@@ -431,7 +475,7 @@ struct RigidRender // Single color & Lighting
         /** Build render program **/
         Program program("Shaders/RigidVS.glsl", "Shaders/RigidFS.glsl");
         programID = program.ID;
-        std::cout << "Rigid Program ID: " << programID << std::endl;
+        LOG_DEBUG("Rigid Program ID: %u\n", programID);
 
         // Generate ID of VAO and VBOs
         glGenVertexArrays(1, &vaoID);
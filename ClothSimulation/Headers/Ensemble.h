@@ -0,0 +1,297 @@
+#pragma once
+
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "Cloth.h"
+#include "Rigid.h"
+#include "Parallel.h"
+
+/** Per-instance parameters of an ensemble member **/
+struct EnsembleInstance
+{
+    double structuralCoef = 1000.0;
+    double shearCoef = 50.0;
+    double bendingCoef = 400.0;
+    double dampCoef = 5.0;
+    Vec3T<double> wind;     // Pushes every node once per frame, like Simulation::wind without aerodynamics
+};
+
+/** Many cloths of one topology stepped in lockstep, for parameter studies **/
+// State is laid out AoSoA: instances are grouped into packets of Lanes, and a packet stores every node as
+// [axis][lane], so the spring loop runs the same spring across all lanes of a packet as one SIMD operation.
+// Threads take whole packets. Each lane repeats the arithmetic of the serial reference substep (fixed substeps,
+// no sleeping, no aerodynamics) in the same order, so a lane matches a Simulation with the same parameters.
+template <typename T, int Lanes = 4>
+struct ClothEnsembleT
+{
+    typedef Vec3T<T> Vec3;
+    typedef NodeT<T> Node;
+    typedef SpringT<T> Spring;
+    typedef ClothT<T> Cloth;
+
+    enum SpringKindEnum{
+        STRUCTURAL,
+        SHEAR,
+        BENDING
+    };
+
+    /** Lanes instances, T[3*Lanes] per node: x of every lane, then y, then z **/
+    struct Packet
+    {
+        std::vector<T> position;
+        std::vector<T> velocity;
+        std::vector<T> force;
+        std::vector<T> mobile;      // [node][lane], 0 for pinned nodes, a factor rather than a flag so integration has no branch
+        T hookCoef[3][Lanes];       // By spring kind
+        T dampCoef[Lanes];
+        T wind[3][Lanes];
+        bool windy;                 // Some lane has wind
+    };
+
+    int instanceCount;
+    int nodeCount;
+    int nodesPerRow, nodesPerCol;
+    int iterationFreq;
+    Vec3 clothPos;
+    Vec3 gravity;
+    double timeStep;
+    Ground* ground;
+    Ball* ball;
+
+    /** Shared topology **/
+    std::vector<int> springNodes;   // Both node indices of every spring, in the order of the template's springs
+    std::vector<char> springKind;
+    std::vector<T> restLen;
+    std::vector<T> mass;
+    std::vector<int> gridNodes;
+
+    std::vector<EnsembleInstance> instances;
+    std::vector<Packet> packets;
+
+    ClothEnsembleT(const Cloth& cloth, int count, Ground* g, Ball* b, double step)
+    {
+        instanceCount = count;
+        nodeCount = (int)cloth.nodes.size();
+        nodesPerRow = cloth.nodesPerRow;
+        nodesPerCol = cloth.nodesPerCol;
+        iterationFreq = cloth.iterationFreq;
+        clothPos = cloth.clothPos;
+        gravity = Vec3(0.0, -9.8 / iterationFreq, 0.0);
+        timeStep = step;
+        ground = g;
+        ball = b;
+        gridNodes = cloth.gridNodes;
+
+        /** Springs are told apart by rest length: one spacing, a diagonal, or two spacings **/
+        typename Cloth::NodeIndex index = cloth.nodeIndices();
+        double spacing = 1.0 / cloth.nodesDensity;
+        for (int i = 0; i < cloth.springs.size(); i ++) {
+            const Spring* s = cloth.springs[i];
+            if (s->isTorn) continue;
+            springNodes.push_back(index[s->node1]);
+            springNodes.push_back(index[s->node2]);
+            springKind.push_back(s->restLen < 1.2 * spacing ? STRUCTURAL : (s->restLen < 1.7 * spacing ? SHEAR : BENDING));
+            restLen.push_back(s->restLen);
+        }
+        for (int i = 0; i < nodeCount; i ++) { mass.push_back(cloth.nodes[i]->mass); }
+
+        /** Every instance starts as the template cloth, pinned where it is pinned **/
+        instances.assign(count, EnsembleInstance());
+        packets.resize((count + Lanes - 1) / Lanes);
+        for (int p = 0; p < packets.size(); p ++) {
+            Packet& packet = packets[p];
+            packet.position.resize(nodeCount*3*Lanes);
+            packet.velocity.resize(nodeCount*3*Lanes);
+            packet.force.resize(nodeCount*3*Lanes);
+            packet.mobile.resize(nodeCount*Lanes);
+            for (int i = 0; i < nodeCount; i ++) {
+                const Node* n = cloth.nodes[i];
+                for (int l = 0; l < Lanes; l ++) {
+                    set(packet.position, i, l, n->position);
+                    set(packet.velocity, i, l, n->velocity);
+                    set(packet.force, i, l, n->force);
+                    packet.mobile[i*Lanes+l] = n->isFixed ? 0 : 1;
+                }
+            }
+        }
+        for (int i = 0; i < count; i ++) { setInstance(i, instances[i]); }
+    }
+
+    static void set(std::vector<T>& v, int node, int lane, const Vec3& value)
+    {
+        v[(node*3+0)*Lanes+lane] = value.x;
+        v[(node*3+1)*Lanes+lane] = value.y;
+        v[(node*3+2)*Lanes+lane] = value.z;
+    }
+    static Vec3 get(const std::vector<T>& v, int node, int lane)
+    {
+        return Vec3(v[(node*3+0)*Lanes+lane], v[(node*3+1)*Lanes+lane], v[(node*3+2)*Lanes+lane]);
+    }
+
+    void setInstance(int i, const EnsembleInstance& instance)
+    {
+        instances[i] = instance;
+        Packet& packet = packets[i / Lanes];
+        int l = i % Lanes;
+        packet.hookCoef[STRUCTURAL][l] = instance.structuralCoef;
+        packet.hookCoef[SHEAR][l] = instance.shearCoef;
+        packet.hookCoef[BENDING][l] = instance.bendingCoef;
+        packet.dampCoef[l] = instance.dampCoef;
+        packet.wind[0][l] = instance.wind.x;
+        packet.wind[1][l] = instance.wind.y;
+        packet.wind[2][l] = instance.wind.z;
+        packet.windy = false;
+        for (int k = 0; k < Lanes; k ++) {
+            if (packet.wind[0][k] != 0 || packet.wind[1][k] != 0 || packet.wind[2][k] != 0) packet.windy = true;
+        }
+    }
+
+    /** Hold or release the node at grid (x, y) of one instance where it is **/
+    void setPinned(int i, const Vec2& index, bool pinned)
+    {
+        if (index.x < 0 || index.x >= nodesPerRow || index.y < 0 || index.y >= nodesPerCol) return;
+        packets[i / Lanes].mobile[gridNodes[(int)index.y*nodesPerRow+(int)index.x]*Lanes + i % Lanes] = pinned ? 0 : 1;
+    }
+
+    Vec3 position(int i, int x, int y) const { return get(packets[i / Lanes].position, gridNodes[y*nodesPerRow+x], i % Lanes); }
+    Vec3 velocity(int i, int x, int y) const { return get(packets[i / Lanes].velocity, gridNodes[y*nodesPerRow+x], i % Lanes); }
+
+    /** Write one instance into a cloth of the same topology, to draw or inspect it **/
+    void copyTo(int i, Cloth* cloth) const
+    {
+        const Packet& packet = packets[i / Lanes];
+        for (int n = 0; n < nodeCount; n ++) {
+            cloth->nodes[n]->position = get(packet.position, n, i % Lanes);
+            cloth->nodes[n]->velocity = get(packet.velocity, n, i % Lanes);
+        }
+    }
+
+    /** Same as Simulation::frame with fixed substeps and no aerodynamics, for every instance **/
+    void frame()
+    {
+        parallelFor(0, (int)packets.size(), [&](int p) {
+            pushWind(packets[p]);
+            for (int s = 0; s < iterationFreq; s ++) { substep(packets[p]); }
+        });
+    }
+
+    void substep()
+    {
+        parallelFor(0, (int)packets.size(), [&](int p) { substep(packets[p]); });
+    }
+
+    void pushWind(Packet& packet)
+    {
+        if (!packet.windy) return;
+        for (int i = 0; i < nodeCount; i ++) {
+            T* f = &packet.force[i*3*Lanes];
+            for (int a = 0; a < 3; a ++) {
+                for (int l = 0; l < Lanes; l ++) { f[a*Lanes+l] += packet.wind[a][l]; }
+            }
+        }
+    }
+
+    void substep(Packet& packet)
+    {
+        /** Gravity **/
+        const T g[3] = { gravity.x, gravity.y, gravity.z };
+        for (int i = 0; i < nodeCount; i ++) {
+            T* f = &packet.force[i*3*Lanes];
+            for (int a = 0; a < 3; a ++) {
+                for (int l = 0; l < Lanes; l ++) { f[a*Lanes+l] = mass[i] * g[a] + f[a*Lanes+l]; }
+            }
+        }
+
+        /** Springs, all lanes at once: Spring::tension and applyInternalForce term by term **/
+        // Computed into locals first, so the lane loop only reads the packet and vectorizes without alias checks.
+        // No branch or select in it either, compilers give up on those: degenerate lanes are patched afterwards.
+        T fx[Lanes], fy[Lanes], fz[Lanes], len[Lanes];
+        for (int s = 0; s < restLen.size(); s ++) {
+            int n1 = springNodes[2*s], n2 = springNodes[2*s+1];
+            const T* p1 = &packet.position[n1*3*Lanes];
+            const T* p2 = &packet.position[n2*3*Lanes];
+            const T* v1 = &packet.velocity[n1*3*Lanes];
+            const T* v2 = &packet.velocity[n2*3*Lanes];
+            T* f1 = &packet.force[n1*3*Lanes];
+            T* f2 = &packet.force[n2*3*Lanes];
+            const T* k = packet.hookCoef[(int)springKind[s]];
+            const T* c = packet.dampCoef;
+            T rest = restLen[s];
+            for (int l = 0; l < Lanes; l ++) {
+                T sx = p2[l] - p1[l], sy = p2[Lanes+l] - p1[Lanes+l], sz = p2[2*Lanes+l] - p1[2*Lanes+l];
+                len[l] = sqrt(sz*sz + (sy*sy + sx*sx));
+                T dx = sx / len[l], dy = sy / len[l], dz = sz / len[l];
+                T wx = v2[l] - v1[l], wy = v2[Lanes+l] - v1[Lanes+l], wz = v2[2*Lanes+l] - v1[2*Lanes+l];
+                T f = (len[l] - rest) * k[l] + (wz*dz + (wy*dy + wx*dx)) * c[l];
+                fx[l] = f * dx;
+                fy[l] = f * dy;
+                fz[l] = f * dz;
+            }
+            for (int l = 0; l < Lanes; l ++) {
+                if (len[l] < 1e-9) fx[l] = fy[l] = fz[l] = 0; // Both ends on one point: no force, as in Spring::tension
+            }
+            for (int l = 0; l < Lanes; l ++) {
+                f1[l] += fx[l];
+                f1[Lanes+l] += fy[l];
+                f1[2*Lanes+l] += fz[l];
+                f2[l] -= fx[l];
+                f2[Lanes+l] -= fy[l];
+                f2[2*Lanes+l] -= fz[l];
+            }
+        }
+
+        /** Integrate, as Node::integrate: adding mobile * step is the same as adding the step or nothing **/
+        T dt = timeStep;
+        for (int i = 0; i < nodeCount; i ++) {
+            T* p = &packet.position[i*3*Lanes];
+            T* v = &packet.velocity[i*3*Lanes];
+            T* f = &packet.force[i*3*Lanes];
+            const T* mobile = &packet.mobile[i*Lanes];
+            for (int a = 0; a < 3; a ++) {
+                for (int l = 0; l < Lanes; l ++) {
+                    v[a*Lanes+l] += mobile[l] * (dt * (f[a*Lanes+l] / mass[i]));
+                    p[a*Lanes+l] += mobile[l] * (dt * v[a*Lanes+l]);
+                    f[a*Lanes+l] = 0;
+                }
+            }
+        }
+
+        /** Collision, as ClothT::collideNode, lane by lane: few nodes ever touch **/
+        for (int i = 0; i < nodeCount; i ++) {
+            for (int l = 0; l < Lanes; l ++) { collide(packet, i, l); }
+        }
+    }
+
+    void collide(Packet& packet, int i, int l)
+    {
+        Vec3 position = get(packet.position, i, l);
+        Vec3 velocity = get(packet.velocity, i, l);
+        double groundSkin = 0.01;
+        Vec3 distVec = clothPos + position - ball->center;
+        double safeDist = ball->radius*1.05;
+        bool hitGround = (clothPos + position).y < ground->position.y + groundSkin;
+        if (!hitGround && distVec.lengthSquared() >= safeDist * safeDist * 1.0001) return; // Clearly outside, exact test below
+
+        if (hitGround) {
+            position.y = ground->position.y - clothPos.y + groundSkin;
+            velocity.y = std::max(velocity.y, (T)0.0);
+            velocity = velocity * ground->friction;
+        }
+        distVec = clothPos + position - ball->center;
+        T distLen = distVec.length();
+        if (distLen < safeDist) {
+            distVec.normalize();
+            position = distVec*safeDist + ball->center - clothPos;
+            T inward = Vec3::dot(velocity, distVec);
+            if (inward < 0.0) velocity.axpy(-inward, distVec);
+            velocity = velocity*ball->friction;
+        }
+        set(packet.position, i, l, position);
+        set(packet.velocity, i, l, velocity);
+    }
+};
+
+typedef ClothEnsembleT<Scalar> ClothEnsemble;
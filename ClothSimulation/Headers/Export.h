@@ -0,0 +1,599 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Cloth.h"
+#include "Log.h"
+#include "Trace.h"
+
+/** One piece of output, copied on the simulation thread and written by an export worker **/
+struct ExportJob
+{
+    enum KindEnum {
+        IMAGE_PNG,      // pixels to path
+        IMAGE_Y4M,      // pixels appended to the queue's stream, in submission order
+        MESH_OBJ,       // positions, normals, texCoords and faces to path
+        MESH_PLY,       // positions, normals and faces to path, binary
+        TRAJECTORY      // positions of frameCount frames to path
+    };
+    KindEnum kind;
+    long long index;                    // Frame, or first frame of a trajectory chunk
+    std::string path;
+
+    int width, height;
+    std::vector<unsigned char> pixels;  // RGBA, bottom row first as OpenGL reads them
+
+    int nodeCount, frameCount;
+    std::vector<float> positions;       // World space, xyz per node (and per frame)
+    std::vector<float> normals;
+    std::vector<float> texCoords;
+    std::vector<int> faces;             // Three node indices per face, removed faces included
+
+    size_t size;                        // Bytes held while queued, see ExportQueue
+    long long sequence;                 // Of IMAGE_Y4M jobs
+
+    size_t bytes() const
+    {
+        return pixels.size() + sizeof(float) * (positions.size() + normals.size() + texCoords.size()) + sizeof(int) * faces.size();
+    }
+
+    /** Halves an image in both directions (2x2 average), false for anything that cannot shrink **/
+    bool degrade()
+    {
+        if (kind != IMAGE_PNG || width < 2 || height < 2) return false;
+        int w = width / 2, h = height / 2;
+        for (int row = 0; row < h; row ++) {
+            for (int col = 0; col < w; col ++) {
+                for (int c = 0; c < 4; c ++) {
+                    int sum = pixels[((2 * row) * width + 2 * col) * 4 + c] + pixels[((2 * row) * width + 2 * col + 1) * 4 + c]
+                            + pixels[((2 * row + 1) * width + 2 * col) * 4 + c] + pixels[((2 * row + 1) * width + 2 * col + 1) * 4 + c];
+                    pixels[(row * w + col) * 4 + c] = (unsigned char)((sum + 2) / 4); // In place, row never reads ahead of itself
+                }
+            }
+        }
+        width = w;
+        height = h;
+        pixels.resize((size_t)w * h * 4);
+        return true;
+    }
+};
+
+/** Bounded export queue drained by a pool of writer threads **/
+// Submitting copies nothing more, the job already holds a snapshot, and returns unless the queue is full, so the
+// simulation only waits on storage when writing falls behind by more than capacity bytes. What happens then is the
+// policy: block until a worker frees room, drop the job, or degrade it (images are halved) and drop it only if it
+// still does not fit. Jobs of any kind share the queue, finished ones are recycled by acquire() with their buffers.
+struct ExportQueue
+{
+    enum PolicyEnum { POLICY_BLOCK, POLICY_DROP, POLICY_DEGRADE };
+
+    PolicyEnum policy = POLICY_BLOCK;
+    size_t capacity = 256 << 20;        // Bytes queued or being written
+    int threadCount = 2;
+
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable wakeCond;   // Workers, a job was queued
+    std::condition_variable roomCond;   // Blocked submitters, a job was written
+    std::deque<ExportJob*> queue;
+    std::vector<ExportJob*> spare;
+    size_t held = 0;                    // Bytes of queued jobs and jobs being written
+    bool quit = false;
+
+    /** Y4M stream, frames are converted by any worker and appended in submission order **/
+    FILE* stream = NULL;
+    std::mutex streamLock;
+    std::condition_variable streamCond;
+    long long streamSubmitted = 0;
+    long long streamWritten = 0;
+
+    long long submitted = 0, written = 0, failed = 0, dropped = 0, degraded = 0;
+    double blockedSeconds = 0.0;
+    size_t peakHeld = 0;
+
+    ~ExportQueue()
+    {
+        finish();
+        for (int i = 0; i < spare.size(); i ++) { delete spare[i]; }
+    }
+
+    bool active() const { return !workers.empty(); }
+
+    void start()
+    {
+        if (active()) return;
+        quit = false;
+        for (int i = 0; i < std::max(1, threadCount); i ++) { workers.push_back(std::thread(&ExportQueue::workerLoop, this)); }
+    }
+
+    /** Opens the stream IMAGE_Y4M jobs go to, 4:2:0 full range, width and height even **/
+    bool openStream(const std::string& path, int width, int height, int fps)
+    {
+        if (width % 2 || height % 2) {
+            LOG_ERROR("Export : Y4M 4:2:0 needs an even width and height.\n");
+            return false;
+        }
+        stream = fopen(path.c_str(), "wb");
+        if (!stream) {
+            LOG_ERROR("Export : Cannot write %s.\n", path.c_str());
+            return false;
+        }
+        fprintf(stream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+        return true;
+    }
+
+    /** An empty job to fill and submit, from the pool when one is free **/
+    ExportJob* acquire()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (spare.empty()) return new ExportJob;
+        ExportJob* job = spare.back();
+        spare.pop_back();
+        return job;
+    }
+
+    /** Queues the job, false when the policy dropped it, the queue owns it either way **/
+    bool submit(ExportJob* job)
+    {
+        TRACE_ZONE("exportSubmit");
+        std::unique_lock<std::mutex> guard(lock);
+        submitted ++;
+        size_t size = job->bytes();
+        if (!fits(size)) {
+            if (policy == POLICY_BLOCK) {
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                roomCond.wait(guard, [&] { return fits(size); });
+                blockedSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            } else if (policy == POLICY_DEGRADE && job->degrade() && fits(size = job->bytes())) {
+                degraded ++;
+            } else {
+                dropped ++;
+                spare.push_back(job);
+                return false;
+            }
+        }
+        if (job->kind == ExportJob::IMAGE_Y4M) job->sequence = streamSubmitted ++;
+        job->size = size;
+        held += size;
+        peakHeld = std::max(peakHeld, held);
+        queue.push_back(job);
+        guard.unlock();
+        wakeCond.notify_one();
+        return true;
+    }
+
+    /** Room for size more bytes, a job larger than the capacity fits an empty queue **/
+    bool fits(size_t size) const { return held == 0 || held + size <= capacity; }
+
+    /** Writes everything queued, stops the workers and closes the stream **/
+    void finish()
+    {
+        if (active()) {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                quit = true;
+            }
+            wakeCond.notify_all();
+            for (int i = 0; i < workers.size(); i ++) { workers[i].join(); }
+            workers.clear();
+        }
+        if (stream) fclose(stream);
+        stream = NULL;
+    }
+
+    void workerLoop()
+    {
+        for (;;) {
+            ExportJob* job;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wakeCond.wait(guard, [this] { return quit || !queue.empty(); });
+                if (queue.empty()) return;
+                job = queue.front();
+                queue.pop_front();
+            }
+            bool ok = write(*job);
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                held -= job->size;
+                if (ok) written ++;
+                else failed ++;
+                spare.push_back(job);
+            }
+            roomCond.notify_all();
+        }
+    }
+
+    bool write(const ExportJob& job)
+    {
+        switch (job.kind) {
+            case ExportJob::IMAGE_PNG: return writePng(job);
+            case ExportJob::IMAGE_Y4M: return writeY4m(job);
+            case ExportJob::MESH_OBJ: return writeObj(job);
+            case ExportJob::MESH_PLY: return writePly(job);
+            case ExportJob::TRAJECTORY: return writeTrajectory(job);
+        }
+        return false;
+    }
+
+    void printSummary() const
+    {
+        if (submitted == 0) return;
+        LOG_INFO("Export : %lld written, %lld failed, %lld dropped, %lld degraded, blocked %.2f s, up to %.1f MB queued\n",
+                 written, failed, dropped, degraded, blockedSeconds, peakHeld / 1048576.0);
+    }
+
+    /** --export_policy=block|drop|degrade --export_threads=2 --export_queue_mb=256 **/
+    void parseArgs(int argc, const char* argv[])
+    {
+        for (int i = 1; i < argc; i ++) {
+            if (strcmp(argv[i], "--export_policy=block") == 0) policy = POLICY_BLOCK;
+            if (strcmp(argv[i], "--export_policy=drop") == 0) policy = POLICY_DROP;
+            if (strcmp(argv[i], "--export_policy=degrade") == 0) policy = POLICY_DEGRADE;
+            sscanf(argv[i], "--export_threads=%d", &threadCount);
+            int megabytes;
+            if (sscanf(argv[i], "--export_queue_mb=%d", &megabytes) == 1) capacity = (size_t)std::max(1, megabytes) << 20;
+        }
+    }
+
+    /** -------------------------------- Writers, on the worker threads -------------------------------- **/
+
+    static FILE* open(const std::string& path)
+    {
+        FILE* out = fopen(path.c_str(), "wb");
+        if (!out) LOG_ERROR("Export : Cannot write %s.\n", path.c_str());
+        return out;
+    }
+
+    static bool close(FILE* out)
+    {
+        bool ok = !ferror(out);
+        return fclose(out) == 0 && ok;
+    }
+
+    bool writeY4m(const ExportJob& job)
+    {
+        int width = job.width, height = job.height;
+        std::vector<unsigned char> planes((size_t)width * height * 3 / 2);
+        unsigned char* y = &planes[0];
+        unsigned char* u = y + width * height;
+        unsigned char* v = u + width * height / 4;
+        for (int row = 0; row < height; row ++) {
+            const unsigned char* src = &job.pixels[(size_t)(height - 1 - row) * width * 4]; // GL rows are bottom up
+            for (int col = 0; col < width; col ++) {
+                const unsigned char* p = src + col * 4;
+                y[row * width + col] = (unsigned char)(0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2] + 0.5f);
+            }
+        }
+        for (int row = 0; row < height / 2; row ++) {
+            for (int col = 0; col < width / 2; col ++) {
+                float r = 0.0f, g = 0.0f, b = 0.0f;
+                for (int k = 0; k < 4; k ++) { // 2x2 average
+                    const unsigned char* p = &job.pixels[((size_t)(height - 1 - (2 * row + k / 2)) * width + 2 * col + k % 2) * 4];
+                    r += p[0] * 0.25f;
+                    g += p[1] * 0.25f;
+                    b += p[2] * 0.25f;
+                }
+                u[row * width / 2 + col] = clampByte(128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b);
+                v[row * width / 2 + col] = clampByte(128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b);
+            }
+        }
+        std::unique_lock<std::mutex> guard(streamLock);
+        streamCond.wait(guard, [&] { return streamWritten == job.sequence; });
+        bool ok = stream && fputs("FRAME\n", stream) >= 0 && fwrite(&planes[0], 1, planes.size(), stream) == planes.size();
+        streamWritten ++;
+        guard.unlock();
+        streamCond.notify_all();
+        return ok;
+    }
+
+    // Stored (uncompressed) deflate blocks, the project does not link zlib
+    static bool writePng(const ExportJob& job)
+    {
+        int width = job.width, height = job.height;
+        FILE* out = open(job.path);
+        if (!out) return false;
+        // Scanlines top down, filter byte 0 and RGB
+        size_t stride = 1 + (size_t)width * 3;
+        std::vector<unsigned char> raw(stride * height);
+        for (int row = 0; row < height; row ++) {
+            const unsigned char* src = &job.pixels[(size_t)(height - 1 - row) * width * 4];
+            unsigned char* dst = &raw[row * stride];
+            dst[0] = 0;
+            for (int col = 0; col < width; col ++) {
+                dst[1 + col * 3] = src[col * 4];
+                dst[2 + col * 3] = src[col * 4 + 1];
+                dst[3 + col * 3] = src[col * 4 + 2];
+            }
+        }
+        // zlib stream of stored deflate blocks
+        std::vector<unsigned char> zlib;
+        zlib.push_back(0x78);
+        zlib.push_back(0x01);
+        for (size_t at = 0; at < raw.size() || at == 0; at += 65535) {
+            size_t len = std::min((size_t)65535, raw.size() - at);
+            zlib.push_back(at + len == raw.size() ? 1 : 0);
+            zlib.push_back(len & 0xff);
+            zlib.push_back(len >> 8);
+            zlib.push_back(~len & 0xff);
+            zlib.push_back((~len >> 8) & 0xff);
+            zlib.insert(zlib.end(), raw.begin() + at, raw.begin() + at + len);
+        }
+        unsigned adler = adler32(&raw[0], raw.size());
+        for (int s = 24; s >= 0; s -= 8) { zlib.push_back((adler >> s) & 0xff); }
+
+        unsigned char header[13];
+        putBigEndian(header, width);
+        putBigEndian(header + 4, height);
+        header[8] = 8;  // Bits per channel
+        header[9] = 2;  // RGB
+        header[10] = 0; // Deflate
+        header[11] = 0; // Adaptive filtering
+        header[12] = 0; // No interlace
+        fwrite("\x89PNG\r\n\x1a\n", 1, 8, out);
+        writeChunk(out, "IHDR", header, sizeof(header));
+        writeChunk(out, "IDAT", &zlib[0], zlib.size());
+        writeChunk(out, "IEND", NULL, 0);
+        return close(out);
+    }
+
+    static bool writeObj(const ExportJob& job)
+    {
+        FILE* out = open(job.path);
+        if (!out) return false;
+        fprintf(out, "# Cloth frame %lld\n", job.index);
+        for (int i = 0; i < job.nodeCount; i ++) {
+            const float* p = &job.positions[3*i];
+            fprintf(out, "v %.6f %.6f %.6f\n", p[0], p[1], p[2]);
+        }
+        for (int i = 0; i < job.nodeCount; i ++) { fprintf(out, "vt %.6f %.6f\n", job.texCoords[2*i], job.texCoords[2*i+1]); }
+        for (int i = 0; i < job.nodeCount; i ++) {
+            const float* n = &job.normals[3*i];
+            fprintf(out, "vn %.6f %.6f %.6f\n", n[0], n[1], n[2]);
+        }
+        for (int f = 0; f + 2 < job.faces.size(); f += 3) {
+            const int* v = &job.faces[f];
+            if (v[0] == v[1] && v[0] == v[2]) continue; // Torn off
+            fprintf(out, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", v[0]+1, v[0]+1, v[0]+1, v[1]+1, v[1]+1, v[1]+1, v[2]+1, v[2]+1, v[2]+1);
+        }
+        return close(out);
+    }
+
+    // Binary little endian, as every target of the project is
+    static bool writePly(const ExportJob& job)
+    {
+        FILE* out = open(job.path);
+        if (!out) return false;
+        std::vector<int> faces;
+        for (int f = 0; f + 2 < job.faces.size(); f += 3) {
+            const int* v = &job.faces[f];
+            if (v[0] != v[1] || v[0] != v[2]) faces.insert(faces.end(), v, v + 3);
+        }
+        fprintf(out, "ply\nformat binary_little_endian 1.0\ncomment Cloth frame %lld\n", job.index);
+        fprintf(out, "element vertex %d\nproperty float x\nproperty float y\nproperty float z\n", job.nodeCount);
+        fprintf(out, "property float nx\nproperty float ny\nproperty float nz\n");
+        fprintf(out, "element face %d\nproperty list uchar int vertex_indices\nend_header\n", (int)faces.size() / 3);
+        std::vector<float> vertexes(6 * job.nodeCount);
+        for (int i = 0; i < job.nodeCount; i ++) {
+            memcpy(&vertexes[6*i], &job.positions[3*i], 3 * sizeof(float));
+            memcpy(&vertexes[6*i+3], &job.normals[3*i], 3 * sizeof(float));
+        }
+        if (!vertexes.empty()) fwrite(&vertexes[0], sizeof(float), vertexes.size(), out);
+        std::vector<unsigned char> records(13 * (faces.size() / 3));
+        for (int f = 0; f < faces.size() / 3; f ++) {
+            records[13*f] = 3;
+            memcpy(&records[13*f+1], &faces[3*f], 3 * sizeof(int));
+        }
+        if (!records.empty()) fwrite(&records[0], 1, records.size(), out);
+        return close(out);
+    }
+
+    /** "CLOTHTRJ", version, node count, frame count, first frame, then xyz floats per node per frame **/
+    static bool writeTrajectory(const ExportJob& job)
+    {
+        FILE* out = open(job.path);
+        if (!out) return false;
+        int header[3] = { 1, job.nodeCount, job.frameCount };
+        fwrite("CLOTHTRJ", 1, 8, out);
+        fwrite(header, sizeof(int), 3, out);
+        fwrite(&job.index, sizeof(job.index), 1, out);
+        if (!job.positions.empty()) fwrite(&job.positions[0], sizeof(float), job.positions.size(), out);
+        return close(out);
+    }
+
+    static void writeChunk(FILE* out, const char* type, const unsigned char* data, size_t size)
+    {
+        unsigned char word[4];
+        putBigEndian(word, (unsigned)size);
+        fwrite(word, 1, 4, out);
+        fwrite(type, 1, 4, out);
+        if (size > 0) fwrite(data, 1, size, out);
+        unsigned crc = crc32(0xffffffffu, (const unsigned char*)type, 4);
+        if (size > 0) crc = crc32(crc, data, size);
+        putBigEndian(word, crc ^ 0xffffffffu);
+        fwrite(word, 1, 4, out);
+    }
+
+    static unsigned crc32(unsigned crc, const unsigned char* data, size_t size)
+    {
+        static const std::vector<unsigned> table = [] {
+            std::vector<unsigned> t(256);
+            for (unsigned n = 0; n < 256; n ++) {
+                unsigned c = n;
+                for (int k = 0; k < 8; k ++) { c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1; }
+                t[n] = c;
+            }
+            return t;
+        }(); // Thread-safe initialization, workers may get here together
+        for (size_t i = 0; i < size; i ++) { crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8); }
+        return crc;
+    }
+
+    static unsigned adler32(const unsigned char* data, size_t size)
+    {
+        unsigned a = 1, b = 0;
+        for (size_t i = 0; i < size; i ++) {
+            a = (a + data[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        return (b << 16) | a;
+    }
+
+    static void putBigEndian(unsigned char* out, unsigned value)
+    {
+        for (int i = 0; i < 4; i ++) { out[i] = (value >> (24 - 8 * i)) & 0xff; }
+    }
+
+    static unsigned char clampByte(float value) { return (unsigned char)std::max(0.0f, std::min(255.0f, value + 0.5f)); }
+};
+
+/** Mesh and trajectory export of a cloth, snapshotted once per simulation frame **/
+// --export_mesh=out/cloth_%05d.obj (or .ply) writes a mesh every --export_every frames, --export_trajectory=
+// out/chunk_%04d.bin collects the node positions of --trajectory_chunk frames per file. Both go through queue.
+struct ClothExporter
+{
+    ExportQueue* queue;
+    std::string meshPattern;
+    std::string trajectoryPattern;
+    int every = 1;
+    int chunkFrames = 120;
+    ExportJob* chunk = NULL;    // Trajectory chunk being filled
+
+    ClothExporter(ExportQueue* q) { queue = q; }
+
+    bool enabled() const { return !meshPattern.empty() || !trajectoryPattern.empty(); }
+
+    /** Returns false when a path pattern is unusable, see format() **/
+    bool parseArgs(int argc, const char* argv[])
+    {
+        for (int i = 1; i < argc; i ++) {
+            if (strncmp(argv[i], "--export_mesh=", 14) == 0) meshPattern = argv[i] + 14;
+            if (strncmp(argv[i], "--export_trajectory=", 20) == 0) trajectoryPattern = argv[i] + 20;
+            if (sscanf(argv[i], "--export_every=%d", &every) == 1) every = std::max(1, every);
+            if (sscanf(argv[i], "--trajectory_chunk=%d", &chunkFrames) == 1) chunkFrames = std::max(1, chunkFrames);
+        }
+        return (meshPattern.empty() || checkPattern(meshPattern, "--export_mesh"))
+            && (trajectoryPattern.empty() || checkPattern(trajectoryPattern, "--export_trajectory"));
+    }
+
+    template <typename T>
+    void frame(const ClothT<T>& cloth, long long index)
+    {
+        if (!enabled()) return;
+        TRACE_ZONE("export");
+        queue->start();
+        int count = (int)cloth.nodes.size();
+        if (!meshPattern.empty() && index % every == 0) {
+            ExportJob* job = queue->acquire();
+            bool ply = meshPattern.size() > 4 && meshPattern.compare(meshPattern.size() - 4, 4, ".ply") == 0;
+            job->kind = ply ? ExportJob::MESH_PLY : ExportJob::MESH_OBJ;
+            job->index = index;
+            job->path = format(meshPattern, index);
+            job->nodeCount = count;
+            job->frameCount = 1;
+            job->pixels.clear();
+            job->positions.resize(3 * count);
+            job->normals.resize(3 * count);
+            job->texCoords.resize(ply ? 0 : 2 * count);
+            for (int i = 0; i < count; i ++) {
+                const NodeT<T>* n = cloth.nodes[i];
+                putVec3(&job->positions[3*i], cloth.clothPos + n->position);
+                putVec3(&job->normals[3*i], n->normal);
+                if (!ply) {
+                    job->texCoords[2*i] = (float)n->texCoord.x;
+                    job->texCoords[2*i+1] = (float)n->texCoord.y;
+                }
+            }
+            job->faces = cloth.faceIndices;
+            queue->submit(job);
+        }
+        if (!trajectoryPattern.empty()) {
+            if (!chunk) {
+                chunk = queue->acquire();
+                chunk->kind = ExportJob::TRAJECTORY;
+                chunk->index = index;
+                chunk->path = format(trajectoryPattern, index / chunkFrames);
+                chunk->nodeCount = count;
+                chunk->frameCount = 0;
+                chunk->pixels.clear();
+                chunk->positions.clear();
+                chunk->normals.clear();
+                chunk->texCoords.clear();
+                chunk->faces.clear();
+            }
+            size_t at = chunk->positions.size();
+            chunk->positions.resize(at + 3 * count);
+            for (int i = 0; i < count; i ++) { putVec3(&chunk->positions[at + 3*i], cloth.clothPos + cloth.nodes[i]->position); }
+            if (++ chunk->frameCount == chunkFrames) flush();
+        }
+    }
+
+    /** Submits the partial trajectory chunk, call after the last frame **/
+    void flush()
+    {
+        if (chunk) queue->submit(chunk);
+        chunk = NULL;
+    }
+
+    template <typename T>
+    static void putVec3(float* out, const Vec3T<T>& v)
+    {
+        out[0] = (float)v.x;
+        out[1] = (float)v.y;
+        out[2] = (float)v.z;
+    }
+
+    /** Path of an index: the pattern holds exactly one integer conversion (%d, %05d, ...), and %% for a literal % **/
+    // Patterns come from the command line, so they never reach printf as a format, only their one conversion does.
+    static std::string format(const std::string& pattern, long long index)
+    {
+        std::string prefix, spec, suffix;
+        if (!splitPattern(pattern, prefix, spec, suffix)) return pattern; // Rejected up front by checkPattern()
+        char number[64];
+        snprintf(number, sizeof(number), spec.c_str(), index);
+        return prefix + number + suffix;
+    }
+
+    static bool checkPattern(const std::string& pattern, const char* option)
+    {
+        std::string prefix, spec, suffix;
+        if (splitPattern(pattern, prefix, spec, suffix)) return true;
+        printf("Export: %s=%s needs exactly one integer conversion such as %%05d, write %%%% for a literal %%\n", option, pattern.c_str());
+        return false;
+    }
+
+    /** Text before and after the conversion, and the conversion itself widened to long long **/
+    static bool splitPattern(const std::string& pattern, std::string& prefix, std::string& spec, std::string& suffix)
+    {
+        int conversions = 0;
+        for (size_t i = 0; i < pattern.size(); i ++) {
+            std::string& text = conversions == 0 ? prefix : suffix;
+            if (pattern[i] != '%') {
+                text += pattern[i];
+                continue;
+            }
+            if (i + 1 < pattern.size() && pattern[i + 1] == '%') {
+                text += '%';
+                i ++;
+                continue;
+            }
+            size_t end = pattern.find_first_not_of("-+ #0", i + 1);                 // Flags
+            end = pattern.find_first_not_of("0123456789", end);                      // Width
+            if (end < pattern.size() && pattern[end] == '.') end = pattern.find_first_not_of("0123456789", end + 1); // Precision
+            if (end >= pattern.size() || (pattern[end] != 'd' && pattern[end] != 'i') || ++ conversions > 1) return false;
+            spec = pattern.substr(i, end - i) + "lld";
+            i = end;
+        }
+        return conversions == 1;
+    }
+};
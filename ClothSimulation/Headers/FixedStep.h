@@ -0,0 +1,62 @@
+#pragma once
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "Log.h"
+#include "Trace.h"
+
+/** Fixed-timestep accumulator: how many simulation frames the elapsed wall-clock time asks for **/
+// Every tick is one Simulation::frame(), always the same length of simulated time, so the trajectory does not
+// depend on the display: a 144 Hz monitor runs fewer ticks per rendered frame, a dropped frame runs more. What is
+// left of the elapsed time after the last whole tick is carried to the next rendered frame, and alpha, its fraction
+// of a tick, is how far the rendered cloth is blended from the state before the last tick to the one after it.
+// At most maxTicks run per rendered frame: a machine that cannot keep up loses the rest instead of falling further
+// behind every frame (spiral of death), the simulation then runs slower than real time.
+struct FixedStep
+{
+    double tickRate = 60.0;     // Simulation frames per wall-clock second, 0 runs one per rendered frame
+    int maxTicks = 4;           // Per rendered frame
+
+    double accumulator = 0.0;   // Wall-clock seconds not simulated yet, less than one tick after advance()
+    double alpha = 1.0;         // Blend of the last two states to render, 1 is the latest
+    long long ticks = 0;
+    long long droppedTicks = 0; // Lost to maxTicks
+
+    bool enabled() const { return tickRate > 0.0; }
+
+    /** Adds elapsed wall-clock seconds, returns the ticks to run before rendering **/
+    int advance(double elapsed)
+    {
+        if (!enabled()) {
+            alpha = 1.0;
+            ticks ++;
+            return 1;
+        }
+        double tick = 1.0 / tickRate;
+        accumulator += std::max(0.0, elapsed);
+        int due = (int)std::min(floor(accumulator / tick), 1e9);
+        int run = std::min(due, maxTicks);
+        if (due > run) {
+            droppedTicks += due - run;
+            accumulator -= (due - run) * tick;
+            LOG_DEBUG("Fixed step: %d ticks behind, dropped\n", due - run);
+        }
+        accumulator -= run * tick;
+        alpha = std::max(0.0, std::min(1.0, accumulator / tick));
+        ticks += run;
+        TRACE_COUNTER("ticks", run);
+        return run;
+    }
+
+    /** --tick_rate=60 --max_ticks=4 **/
+    void parseArgs(int argc, const char* argv[])
+    {
+        for (int i = 1; i < argc; i ++) {
+            sscanf(argv[i], "--tick_rate=%lf", &tickRate);
+            if (sscanf(argv[i], "--max_ticks=%d", &maxTicks) == 1) maxTicks = std::max(1, maxTicks);
+        }
+    }
+};
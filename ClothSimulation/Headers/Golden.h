@@ -0,0 +1,370 @@
+#pragma once
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Cloth.h"
+#include "Rigid.h"
+#include "Parallel.h"
+#include "Simulation.h"
+
+/** Golden-trajectory accuracy harness **/
+// The serial double precision path is the reference. Optimized backends run the same canonical scenes and
+// every frame is compared with the reference by max and RMS node deviation.
+// Record: ClothSimulation --golden_record [--golden_frames=120] [--golden_dir=Golden]
+// Check:  ClothSimulation --golden_check [--golden_backend=parallel] [--golden_max=...] [--golden_rms=...]
+// Each backend has its own thresholds (see GoldenHarness()), --golden_max / --golden_rms override them.
+
+struct GoldenScene
+{
+    enum GoldenSceneEnum {
+        HANGING,        // Pinned cloth, nothing to collide with
+        DROP_ON_BALL,   // Both pins released, falls on the ball and the ground
+        WIND,           // Pinned cloth under a constant wind
+        GUSTS           // Pinned cloth with aerodynamic drag and lift in a turbulent wind field
+    };
+    static const int sceneCount = 4;
+    
+    static const char* name(GoldenSceneEnum t)
+    {
+        switch (t) {
+            case HANGING: return "hanging";
+            case DROP_ON_BALL: return "drop-on-ball";
+            case WIND: return "wind";
+            default: return "gusts";
+        }
+    }
+};
+
+template <typename T>
+struct GoldenSceneT : GoldenScene
+{
+    GoldenSceneEnum type;
+    
+    ClothT<T> cloth;
+    Ground ground;
+    Ball ball;
+    SimulationT<T> simulation;
+    Vec3 wind;
+    
+    /** No scene starts with the cloth inside the ball, and no node sits on the ball's center, so which way a contact
+        pushes never comes down to rounding: the dropped cloth starts above the ball and off its center plane, the
+        wind pushes the pinned cloth onto a ball behind it **/
+    static Vec3 clothCorner(GoldenSceneEnum t) { return t == DROP_ON_BALL ? Vec3(-3, 11.5, -2) : Vec3(-3, 7.5, -2); }
+    static Vec3 ballCenter(GoldenSceneEnum t)
+    {
+        switch (t) {
+            case HANGING: return Vec3(0, -50, -2);
+            case DROP_ON_BALL: return Vec3(0, 3, -1.6);
+            default: return Vec3(0, 3, -3.5);
+        }
+    }
+
+    GoldenSceneT(GoldenSceneEnum t, typename ClothT<T>::NodeOrderEnum order = ClothT<T>::ORDER_GRID)
+    : type(t),
+      cloth(clothCorner(t), Vec2(6, 6)),
+      ground(Vec3(-5, 1.5, 0), Vec2(10, 10), glm::vec4(0.8, 0.8, 0.8, 1.0)),
+      ball(ballCenter(t), 1, glm::vec4(0.6f, 0.5f, 0.8f, 1.0f)),
+      simulation(&cloth, &ground, &ball, 0.01)
+    {
+        cloth.reorder(order); // Before anything holds node indices, as the window does
+        if (type == DROP_ON_BALL) {
+            cloth.unPin(cloth.pin1);
+            cloth.unPin(cloth.pin2);
+        }
+        wind = (type == WIND) ? Vec3(6.0, 0.0, -14.0) : Vec3(0.0, 0.0, 0.0);
+        if (type == GUSTS) {
+            simulation.aerodynamics = true;
+            simulation.windField.gust = 2.0;
+            wind = Vec3(2.0, 0.0, -6.0); // m/s
+        }
+        simulation.commands.push(SimCommand::make(SimCommand::SET_WIND, wind));
+    }
+
+    void frame()
+    {
+        simulation.frame();
+    }
+
+    void capture(std::vector<double>& positions) // x, y, z of every node in grid order, whatever the memory order
+    {
+        positions.resize(cloth.nodes.size()*3);
+        for (int i = 0; i < cloth.nodes.size(); i ++) {
+            const NodeT<T>* n = cloth.nodes[cloth.gridNodes[i]];
+            positions[i*3+0] = n->position.x;
+            positions[i*3+1] = n->position.y;
+            positions[i*3+2] = n->position.z;
+        }
+    }
+};
+
+/** A way of stepping the scene that should reproduce the reference within tolerance **/
+struct GoldenBackend
+{
+    enum GoldenPrecisionEnum {
+        BUILD_SCALAR,   // Scalar the build was configured with
+        DOUBLE,
+        FLOAT
+    };
+    const char* name;
+    GoldenPrecisionEnum precision;
+    void (*enable)(SimulationOptions& options);
+    void (*disable)(SimulationOptions& options);
+    double maxDistance;     // Largest allowed distance of any node from the reference, per frame
+    double rmsDistance;     // Largest allowed RMS distance over all nodes, per frame
+    int scenes;             // Bit per GoldenSceneEnum this backend is judged on
+    Cloth::NodeOrderEnum order; // Memory order of the cloth nodes, capture() reads them in grid order anyway
+};
+
+void goldenSerial(SimulationOptions&) { threadPool.resize(1); }
+void goldenParallel(SimulationOptions&) { threadPool.resize(std::max(2, (int)std::thread::hardware_concurrency())); }
+void goldenAdaptive(SimulationOptions& options) { options.adaptive = true; }
+void goldenFixed(SimulationOptions& options) { options.adaptive = false; }
+void goldenSleeping(SimulationOptions& options) { options.sleeping = true; }
+void goldenAwake(SimulationOptions& options) { options.sleeping = false; }
+void goldenBlocked(SimulationOptions& options) { options.blocked = true; }
+void goldenUnblocked(SimulationOptions& options) { options.blocked = false; }
+
+struct GoldenTrajectory
+{
+    int nodeCount = 0;
+    std::vector< std::vector<double> > frames;
+    bool invalid = false; // Set by load() when the file exists but is not one whole trajectory
+
+    bool save(const char* path)
+    {
+        FILE* file = fopen(path, "wb");
+        if (file == NULL) return false;
+        int header[4] = { 0x54434C47, 1, nodeCount, (int)frames.size() }; // "GLCT", version
+        fwrite(header, sizeof(int), 4, file);
+        for (int i = 0; i < frames.size(); i ++) {
+            fwrite(&frames[i][0], sizeof(double), nodeCount*3, file);
+        }
+        fclose(file);
+        return true;
+    }
+
+    bool load(const char* path)
+    {
+        FILE* file = fopen(path, "rb");
+        if (file == NULL) return false;
+        int header[4];
+        bool ok = fread(header, sizeof(int), 4, file) == 4 && header[0] == 0x54434C47 && header[1] == 1;
+        // Counts come from the file: both positive and exactly the payload that follows, before anything is allocated
+        ok = ok && header[2] > 0 && header[3] > 0;
+        if (ok) {
+            long payload = ftell(file);
+            ok = fseek(file, 0, SEEK_END) == 0 && ftell(file) - payload == (long long)header[2] * 3 * header[3] * sizeof(double)
+                 && fseek(file, payload, SEEK_SET) == 0;
+        }
+        if (ok) {
+            nodeCount = header[2];
+            frames.assign(header[3], std::vector<double>(nodeCount*3));
+            for (int i = 0; ok && i < frames.size(); i ++) {
+                ok = fread(&frames[i][0], sizeof(double), nodeCount*3, file) == nodeCount*3;
+            }
+        }
+        fclose(file);
+        if (!ok) {
+            printf("Golden: %s is not a valid trajectory file\n", path);
+            invalid = true;
+        }
+        return ok;
+    }
+};
+
+struct GoldenHarness
+{
+    std::vector<GoldenBackend> backends;
+
+    bool recording;
+    int frameCount;
+    std::string directory;
+    std::string backendName;
+    double maxThreshold;  // Overrides the backend's maxDistance when set
+    double rmsThreshold;  // Overrides the backend's rmsDistance when set
+
+    /** Thresholds are a few times the worst deviation each backend shows over 120 frames, so red means a regression **/
+    // reference: a stored golden from another compiler or machine may differ by rounding, 1 cm still means physics changed.
+    // parallel, blocked, morton, hilbert: only the summation order differs, 1e-12 m measured; 1e-6 leaves room for
+    // more threads.
+    // float: single precision, up to 6.5 cm / 7.6 mm RMS after the dropped cloth hits the ball.
+    // sleeping: the hanging cloth stops settling once asleep, 9 mm / 5 mm RMS; the other scenes never sleep.
+    // adaptive: a different substep count is a different discretization; contact and flapping then move the
+    // cloth by metres within a second, so only the hanging scene is judged (1.3 cm on the first frame, the pins
+    // settling).
+    GoldenHarness()
+    {
+        const int all = (1 << GoldenScene::sceneCount) - 1;
+        GoldenBackend serial = { "reference", GoldenBackend::DOUBLE, goldenSerial, goldenSerial, 0.01, 0.001, all, Cloth::ORDER_GRID };
+        GoldenBackend parallel = { "parallel", GoldenBackend::BUILD_SCALAR, goldenParallel, goldenSerial, 1e-6, 1e-7, all, Cloth::ORDER_GRID };
+        GoldenBackend adaptive = { "adaptive", GoldenBackend::BUILD_SCALAR, goldenAdaptive, goldenFixed, 0.05, 0.005, 1 << GoldenScene::HANGING, Cloth::ORDER_GRID };
+        GoldenBackend sleeping = { "sleeping", GoldenBackend::BUILD_SCALAR, goldenSleeping, goldenAwake, 0.05, 0.03, all, Cloth::ORDER_GRID };
+        GoldenBackend single = { "float", GoldenBackend::FLOAT, goldenSerial, goldenSerial, 0.5, 0.05, all, Cloth::ORDER_GRID };
+        GoldenBackend blocked = { "blocked", GoldenBackend::BUILD_SCALAR, goldenBlocked, goldenUnblocked, 1e-6, 1e-7, all, Cloth::ORDER_GRID };
+        GoldenBackend morton = { "morton", GoldenBackend::BUILD_SCALAR, goldenSerial, goldenSerial, 1e-6, 1e-7, all, Cloth::ORDER_MORTON };
+        GoldenBackend hilbert = { "hilbert", GoldenBackend::BUILD_SCALAR, goldenSerial, goldenSerial, 1e-6, 1e-7, all, Cloth::ORDER_HILBERT };
+        backends.push_back(serial);
+        backends.push_back(parallel);
+        backends.push_back(adaptive);
+        backends.push_back(sleeping);
+        backends.push_back(single);
+        backends.push_back(blocked);
+        backends.push_back(morton);
+        backends.push_back(hilbert);
+
+        recording = false;
+        frameCount = 120;
+        directory = "Golden";
+        backendName = "parallel";
+        maxThreshold = -1.0;
+        rmsThreshold = -1.0;
+    }
+
+    /** Returns false when the harness was not requested **/
+    bool parseArgs(int argc, const char* argv[])
+    {
+        bool enabled = false;
+        for (int i = 1; i < argc; i ++) {
+            const char* arg = argv[i];
+            if (strcmp(arg, "--golden_record") == 0) { enabled = true; recording = true; }
+            else if (strcmp(arg, "--golden_check") == 0) enabled = true;
+            else if (strncmp(arg, "--golden_frames=", 16) == 0) frameCount = std::max(1, atoi(arg + 16));
+            else if (strncmp(arg, "--golden_dir=", 13) == 0) directory = arg + 13;
+            else if (strncmp(arg, "--golden_backend=", 17) == 0) backendName = arg + 17;
+            else if (strncmp(arg, "--golden_max=", 13) == 0) maxThreshold = atof(arg + 13);
+            else if (strncmp(arg, "--golden_rms=", 13) == 0) rmsThreshold = atof(arg + 13);
+        }
+        return enabled;
+    }
+
+    std::string path(GoldenScene::GoldenSceneEnum type)
+    {
+        return directory + "/" + GoldenScene::name(type) + ".traj";
+    }
+
+    GoldenTrajectory simulate(GoldenScene::GoldenSceneEnum type, const GoldenBackend& backend)
+    {
+        switch (backend.precision) {
+            case GoldenBackend::DOUBLE: return simulate<double>(type, backend);
+            case GoldenBackend::FLOAT: return simulate<float>(type, backend);
+            default: return simulate<Scalar>(type, backend);
+        }
+    }
+    
+    template <typename T>
+    GoldenTrajectory simulate(GoldenScene::GoldenSceneEnum type, const GoldenBackend& backend)
+    {
+        GoldenSceneT<T> scene(type, (typename ClothT<T>::NodeOrderEnum)backend.order);
+        backend.enable(scene.simulation);
+        GoldenTrajectory trajectory;
+        trajectory.nodeCount = (int)scene.cloth.nodes.size();
+        trajectory.frames.resize(frameCount);
+        for (int f = 0; f < frameCount; f ++) {
+            scene.frame();
+            scene.capture(trajectory.frames[f]);
+        }
+        backend.disable(scene.simulation);
+        return trajectory;
+    }
+
+    int run()
+    {
+        if (recording) {
+            mkdir(directory.c_str(), 0755);
+            for (int t = 0; t < GoldenScene::sceneCount; t ++) {
+                GoldenScene::GoldenSceneEnum type = (GoldenScene::GoldenSceneEnum)t;
+                GoldenTrajectory reference = simulate(type, backends[0]);
+                if (!reference.save(path(type).c_str())) {
+                    printf("Golden: Failed to write %s\n", path(type).c_str());
+                    return 1;
+                }
+                printf("Golden: Recorded %s (%d frames, %d nodes)\n", path(type).c_str(), frameCount, reference.nodeCount);
+            }
+            return 0;
+        }
+
+        const GoldenBackend* backend = NULL;
+        for (int i = 0; i < backends.size(); i ++) {
+            if (backendName == backends[i].name) backend = &backends[i];
+        }
+        if (backend == NULL) {
+            printf("Golden: Unknown backend %s\n", backendName.c_str());
+            return 1;
+        }
+
+        double maxDistance = backend->maxDistance, rmsDistance = backend->rmsDistance;
+        if (backend->precision == GoldenBackend::BUILD_SCALAR && sizeof(Scalar) < sizeof(double)) { // A float build, at least the float backend's
+            maxDistance = std::max(maxDistance, backends[4].maxDistance);
+            rmsDistance = std::max(rmsDistance, backends[4].rmsDistance);
+        }
+        if (maxThreshold < 0.0) maxThreshold = maxDistance;
+        if (rmsThreshold < 0.0) rmsThreshold = rmsDistance;
+        printf("Golden: %s within %g max, %g RMS\n", backend->name, maxThreshold, rmsThreshold);
+        printf("%-14s %-12s %8s %14s %14s %8s  %s\n", "Scene", "Backend", "Frames", "Max", "RMS", "Worst", "Status");
+        int failures = 0;
+        for (int t = 0; t < GoldenScene::sceneCount; t ++) {
+            GoldenScene::GoldenSceneEnum type = (GoldenScene::GoldenSceneEnum)t;
+            if (!(backend->scenes & (1 << t))) {
+                printf("%-14s %-12s not judged for this backend\n", GoldenScene::name(type), backendName.c_str());
+                continue;
+            }
+            GoldenTrajectory reference;
+            if (!reference.load(path(type).c_str())) {
+                if (reference.invalid) {
+                    printf("%-14s %-12s stored reference unreadable, record it again  FAILED\n", GoldenScene::name(type), backendName.c_str());
+                    failures ++;
+                    continue;
+                }
+                reference = simulate(type, backends[0]); // Nothing stored yet, the reference is built in
+            }
+            GoldenTrajectory result = simulate(type, *backend);
+            if (!compare(GoldenScene::name(type), reference, result)) failures ++;
+        }
+        return failures > 0 ? 1 : 0;
+    }
+
+    bool compare(const char* scene, const GoldenTrajectory& reference, const GoldenTrajectory& result)
+    {
+        if (reference.nodeCount != result.nodeCount) {
+            printf("%-14s %-12s node count %d differs from the reference (%d)  FAILED\n", scene, backendName.c_str(), result.nodeCount, reference.nodeCount);
+            return false;
+        }
+        if (reference.frames.size() != result.frames.size()) { // A stale reference must not pass by checking fewer frames
+            printf("%-14s %-12s frame count %d differs from the reference (%d)  FAILED\n", scene, backendName.c_str(), (int)result.frames.size(), (int)reference.frames.size());
+            return false;
+        }
+        int frames = (int)result.frames.size();
+        double worstMax = 0.0, worstRms = 0.0;
+        int worstFrame = 0, firstFailure = -1;
+        for (int f = 0; f < frames; f ++) {
+            const std::vector<double>& a = reference.frames[f];
+            const std::vector<double>& b = result.frames[f];
+            double maxDist = 0.0, sum = 0.0;
+            for (int i = 0; i < result.nodeCount; i ++) {
+                double dx = a[i*3+0] - b[i*3+0], dy = a[i*3+1] - b[i*3+1], dz = a[i*3+2] - b[i*3+2];
+                double d2 = dx*dx + dy*dy + dz*dz;
+                if (d2 != d2) d2 = INFINITY; // NaN always fails
+                maxDist = std::max(maxDist, sqrt(d2));
+                sum += d2;
+            }
+            double rms = sqrt(sum / result.nodeCount);
+            if (maxDist > worstMax) { worstMax = maxDist; worstFrame = f; }
+            worstRms = std::max(worstRms, rms);
+            if (firstFailure < 0 && (maxDist > maxThreshold || rms > rmsThreshold)) firstFailure = f;
+        }
+        if (firstFailure >= 0) {
+            printf("%-14s %-12s %8d %14.3e %14.3e %8d  FAILED from frame %d\n", scene, backendName.c_str(), frames, worstMax, worstRms, worstFrame, firstFailure);
+            return false;
+        }
+        printf("%-14s %-12s %8d %14.3e %14.3e %8d  ok\n", scene, backendName.c_str(), frames, worstMax, worstRms, worstFrame);
+        return true;
+    }
+};
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "Log.h"
+#include "Multires.h"
+#include "Simulation.h"
+#include "Trace.h"
+
+/** Quality settings the governor steps through **/
+struct GovernorLevel
+{
+    const char* name;
+    double courant;         // SimulationOptions::courant, a larger one lets fast motion take fewer adaptive substeps
+    int aeroInterval;       // SimulationOptions::aeroInterval
+    bool detailPhysics;     // MultiresCloth::detailPhysics
+    bool detail;            // Draw the subdivided cloth at all, the coarse one otherwise
+};
+
+/** One frame as the governor saw it **/
+struct GovernorSample
+{
+    float simulate;         // Milliseconds
+    float render;           // Milliseconds, submission only: the swap waits for vsync and is not counted
+    short level;
+};
+
+/** Frame-budget governor: trades simulation and render quality for frame time **/
+// The simulate and render phases of every frame are timed and smoothed. Over budget for degradeFrames frames in a
+// row drops one level; under upgradeAt of the budget for upgradeWait frames climbs one. The gap between the two
+// thresholds keeps it from flipping every frame, and every upgrade that has to be taken back soon doubles the
+// wait before the next one, so a level the machine cannot hold is not retried over and over.
+// Substeps never go below what the spring stability allows: levels only relax the velocity limit of the adaptive
+// substep count and how often aerodynamics and detail are updated, they never make the cloth unstable.
+struct FrameGovernor
+{
+    double budget = 0.0;        // Milliseconds for simulate and render, 0 turns the governor off
+    double smoothing = 0.1;     // Weight of the newest frame in the average
+    double upgradeAt = 0.7;     // Fraction of the budget under which quality climbs
+    int degradeFrames = 10;
+    int upgradeFrames = 60;     // Initial wait, doubled by every upgrade taken back within it (up to 32 times)
+    int historySize = 600;
+
+    std::vector<GovernorLevel> levels;
+    bool detailPhysics = false; // Whether --detail_physics asked for it, no level turns it on otherwise
+    int level = 0;
+    double average = 0.0;       // Smoothed frame time
+    int over = 0, under = 0;    // Frames in a row over budget / under upgradeAt of it
+    int upgradeWait;
+    long long frames = 0;
+    long long lastUpgrade = -1; // Frame of the last upgrade
+    int changes = 0;
+    long long overBudgetFrames = 0;
+    std::vector<GovernorSample> history; // Ring of the last historySize frames
+
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point frameStart, simulateEnd;
+
+    FrameGovernor()
+    {
+        GovernorLevel best = { "full", 0.5, 5, true, true };
+        GovernorLevel fastMotion = { "coarse-motion", 1.0, 5, true, true };
+        GovernorLevel noDetailPhysics = { "no-detail-physics", 1.0, 10, false, true };
+        GovernorLevel coarse = { "coarse", 2.0, 20, false, false };
+        levels.push_back(best);
+        levels.push_back(fastMotion);
+        levels.push_back(noDetailPhysics);
+        levels.push_back(coarse);
+        upgradeWait = upgradeFrames;
+    }
+
+    bool enabled() const { return budget > 0.0; }
+    const GovernorLevel& current() const { return levels[level]; }
+
+    void beginFrame() { frameStart = Clock::now(); }
+    void simulated() { simulateEnd = Clock::now(); }
+
+    /** Ends the frame after rendering, true when the level changed and must be applied **/
+    bool rendered()
+    {
+        Clock::time_point end = Clock::now();
+        double simulate = std::chrono::duration<double, std::milli>(simulateEnd - frameStart).count();
+        double render = std::chrono::duration<double, std::milli>(end - simulateEnd).count();
+        double total = simulate + render;
+        average = frames == 0 ? total : average + smoothing * (total - average);
+        GovernorSample sample = { (float)simulate, (float)render, (short)level };
+        if (history.size() < historySize) history.push_back(sample);
+        else history[frames % historySize] = sample;
+        frames ++;
+        if (total > budget) overBudgetFrames ++;
+        TRACE_COUNTER("frameTime", total);
+        TRACE_COUNTER("qualityLevel", level);
+        if (!enabled()) return false;
+
+        over = average > budget ? over + 1 : 0;
+        under = average < upgradeAt * budget ? under + 1 : 0;
+        if (over >= degradeFrames && level + 1 < levels.size()) {
+            if (lastUpgrade >= 0 && frames - lastUpgrade < 2 * upgradeWait) upgradeWait = std::min(upgradeWait * 2, upgradeFrames * 32);
+            return change(level + 1);
+        }
+        if (under >= upgradeWait && level > 0) {
+            lastUpgrade = frames;
+            return change(level - 1);
+        }
+        return false;
+    }
+
+    bool change(int to)
+    {
+        LOG_INFO("Quality %s -> %s (%.1f ms of %.1f ms)\n", levels[level].name, levels[to].name, average, budget);
+        level = to;
+        over = 0;
+        under = 0;
+        changes ++;
+        return true;
+    }
+
+    template <typename T>
+    void apply(SimulationT<T>& simulation, MultiresClothT<T>* detail) const
+    {
+        simulation.courant = current().courant;
+        simulation.aeroInterval = current().aeroInterval;
+        if (detail) detail->detailPhysics = detailPhysics && current().detailPhysics;
+    }
+
+    /** Frames of the history, oldest first **/
+    GovernorSample sample(int i) const { return history[history.size() < historySize ? i : (frames + i) % historySize]; }
+
+    void printSummary() const
+    {
+        if (!enabled() || history.empty()) return;
+        std::vector<float> totals;
+        std::vector<int> perLevel(levels.size(), 0);
+        for (int i = 0; i < history.size(); i ++) {
+            totals.push_back(history[i].simulate + history[i].render);
+            perLevel[history[i].level] ++;
+        }
+        std::sort(totals.begin(), totals.end());
+        printf("Frame governor: budget %.1f ms, level %s, %d changes, %lld of %lld frames over budget\n",
+               budget, current().name, changes, overBudgetFrames, frames);
+        printf("  last %d frames: p50 %.2f ms, p99 %.2f ms\n", (int)totals.size(), totals[totals.size() / 2], totals[totals.size() * 99 / 100]);
+        for (int l = 0; l < levels.size(); l ++) {
+            if (perLevel[l] > 0) printf("  %-18s %5.1f%%\n", levels[l].name, 100.0 * perLevel[l] / history.size());
+        }
+    }
+
+    /** --frame_budget=16.7 **/
+    bool parseArgs(int argc, const char* argv[])
+    {
+        for (int i = 1; i < argc; i ++) {
+            if (sscanf(argv[i], "--frame_budget=%lf", &budget) == 1) return true;
+        }
+        return false;
+    }
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/** Minimal JSON reader, enough for the files this project writes itself **/
+struct JsonValue
+{
+    enum JsonTypeEnum {
+        JSON_NULL,
+        JSON_BOOL,
+        JSON_NUMBER,
+        JSON_STRING,
+        JSON_ARRAY,
+        JSON_OBJECT
+    };
+    JsonTypeEnum type = JSON_NULL;
+
+    double number = 0.0;            // Bool is stored as 0 / 1
+    std::string string;
+    std::vector<std::string> keys;  // Object: keys[i] names items[i]
+    std::vector<JsonValue> items;   // Array elements or object members
+
+    const JsonValue* get(const char* key) const
+    {
+        for (int i = 0; i < keys.size(); i ++) {
+            if (keys[i] == key) return &items[i];
+        }
+        return NULL;
+    }
+    double getNumber(const char* key, double fallback) const
+    {
+        const JsonValue* v = get(key);
+        return (v && v->type == JSON_NUMBER) ? v->number : fallback;
+    }
+    std::string getString(const char* key, const char* fallback) const
+    {
+        const JsonValue* v = get(key);
+        return (v && v->type == JSON_STRING) ? v->string : fallback;
+    }
+
+    static bool parseFile(const char* path, JsonValue& out)
+    {
+        std::ifstream file(path);
+        if (!file) return false;
+        std::stringstream stream;
+        stream << file.rdbuf();
+        std::string text = stream.str();
+        const char* p = text.c_str();
+        return parse(p, out) && (skipSpace(p), *p == '\0');
+    }
+
+    static void skipSpace(const char*& p)
+    {
+        while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p ++;
+    }
+
+    static bool parseString(const char*& p, std::string& out)
+    {
+        if (*p != '"') return false;
+        p ++;
+        out.clear();
+        while (*p && *p != '"') {
+            if (*p == '\\') {
+                p ++;
+                switch (*p) {
+                    case 'n': out += '\n'; break;
+                    case 't': out += '\t'; break;
+                    case 'r': out += '\r'; break;
+                    case 'b': out += '\b'; break;
+                    case 'f': out += '\f'; break;
+                    case 'u': out += '?'; p += 4; continue; // Non-ASCII is never needed here
+                    case '\0': return false;
+                    default: out += *p; break;
+                }
+                p ++;
+            } else {
+                out += *p ++;
+            }
+        }
+        if (*p != '"') return false;
+        p ++;
+        return true;
+    }
+
+    static bool parse(const char*& p, JsonValue& out)
+    {
+        skipSpace(p);
+        if (*p == '{' || *p == '[') {
+            bool object = (*p == '{');
+            char close = object ? '}' : ']';
+            out.type = object ? JSON_OBJECT : JSON_ARRAY;
+            p ++;
+            skipSpace(p);
+            if (*p == close) { p ++; return true; }
+            for (;;) {
+                if (object) {
+                    skipSpace(p);
+                    std::string key;
+                    if (!parseString(p, key)) return false;
+                    skipSpace(p);
+                    if (*p != ':') return false;
+                    p ++;
+                    out.keys.push_back(key);
+                }
+                out.items.push_back(JsonValue());
+                if (!parse(p, out.items.back())) return false;
+                skipSpace(p);
+                if (*p == ',') { p ++; continue; }
+                if (*p == close) { p ++; return true; }
+                return false;
+            }
+        }
+        if (*p == '"') {
+            out.type = JSON_STRING;
+            return parseString(p, out.string);
+        }
+        if (strncmp(p, "true", 4) == 0) { out.type = JSON_BOOL; out.number = 1.0; p += 4; return true; }
+        if (strncmp(p, "false", 5) == 0) { out.type = JSON_BOOL; out.number = 0.0; p += 5; return true; }
+        if (strncmp(p, "null", 4) == 0) { out.type = JSON_NULL; p += 4; return true; }
+
+        char* end;
+        out.number = strtod(p, &end);
+        if (end == p) return false;
+        out.type = JSON_NUMBER;
+        p = end;
+        return true;
+    }
+};
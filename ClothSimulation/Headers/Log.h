@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdio.h>
+
+/** Leveled logging **/
+// LOG_LEVEL is the most verbose level compiled in, LOG_LEVEL_INFO unless the build defines it. A message above it
+// expands to nothing and its arguments are not evaluated, so per-node debug output costs nothing in normal builds.
+// Output is buffered by stdio and not flushed per line, errors excepted.
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+inline void logWrite(int level, const char* format, ...)
+{
+    FILE* out = level <= LOG_LEVEL_WARN ? stderr : stdout;
+    if (level == LOG_LEVEL_ERROR) fputs("ERROR: ", out);
+    if (level == LOG_LEVEL_WARN) fputs("WARNING: ", out);
+    va_list args;
+    va_start(args, format);
+    vfprintf(out, format, args);
+    va_end(args);
+}
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logWrite(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) logWrite(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logWrite(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logWrite(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...)
+#endif
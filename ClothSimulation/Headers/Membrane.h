@@ -0,0 +1,267 @@
+#pragma once
+
+#include <math.h>
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include "Parallel.h"
+#include "Points.h"
+
+/** Triangle membrane: in-plane stretch and shear of the cloth as a continuum, one element per face **/
+// Each triangle keeps the inverse of its rest edge matrix Dm = [X1 - X0, X2 - X0] (2x2, in the flat rest plane)
+// and its rest area, computed once. The deformation gradient is then F = [x1 - x0, x2 - x0] Dm^-1 (3x2), the
+// first Piola stress P of the material gives the forces of nodes 1 and 2 as the columns of -A P Dm^-T, and node 0
+// takes the opposite of their sum. Elements are stored structure-of-arrays in the order of the face coloring, so a
+// color is a contiguous range, and are evaluated Lanes at a time: positions are gathered into [axis][lane] arrays
+// and the stress arithmetic runs over the lanes, the same layout as the ensemble packets.
+// StVK: P = F (2 mu E + lambda tr(E) I), E = (F^T F - I) / 2, stiffens under large stretch.
+// Co-rotated: P = 2 mu (F - R) + lambda tr(S - I) R, with F = R S the polar decomposition, linear in the rotated
+// frame. Damping is on the co-rotated strain rate, P += 2 damping R sym(R^T dF/dt): like the dashpot of a spring
+// it does not grow with the stretch, so an element pulled far from rest needs no shorter substep for it.
+template <typename T, int Lanes = 4>
+struct MembraneT
+{
+    typedef Vec3T<T> Vec3;
+    typedef NodeT<T> Node;
+
+    bool corotated = false;
+    double lambda = 0.0, mu = 0.0;  // Lame parameters, N/m
+    double damping = 0.0;           // Of the strain rate, N s/m
+
+    /** Elements, in color order **/
+    std::vector<int> elementNodes;  // Three per element, node indices of its face
+    std::vector<int> elementFace;
+    std::vector<int> faceElement;   // Element of each face, -1 for none
+    std::vector<T> inv00, inv01, inv10, inv11; // Dm^-1
+    std::vector<T> area;            // Rest area, 0 once its face is removed
+    std::vector<int> colorStart;    // Elements of color c are [colorStart[c], colorStart[c+1])
+    double minEdge = INFINITY;      // Shortest rest edge, for the substep velocity limit
+
+    /** Tearing: elements stretched past tearStretch along their principal direction **/
+    double tearStretch = 0.0;
+    std::vector<int> tornFaces;
+    std::mutex tearLock;
+
+    bool active() const { return !colorStart.empty(); }
+    int elementCount() const { return (int)elementFace.size(); }
+
+    /** Young's modulus and Poisson ratio of a thin sheet (plane stress) **/
+    void setMaterial(double young, double poisson)
+    {
+        mu = young / (2.0 * (1.0 + poisson));
+        lambda = young * poisson / (1.0 - poisson * poisson);
+    }
+
+    /** Faces as three node indices each, colors as lists of faces, the rest shape as a position per node **/
+    void build(const std::vector<Vec3>& rest, const std::vector<int>& faceIndices, const std::vector< std::vector<int> >& colors)
+    {
+        elementNodes.clear();
+        elementFace.clear();
+        colorStart.assign(1, 0);
+        faceElement.assign(faceIndices.size() / 3, -1);
+        for (int c = 0; c < colors.size(); c ++) {
+            for (int i = 0; i < colors[c].size(); i ++) {
+                int f = colors[c][i];
+                faceElement[f] = (int)elementFace.size();
+                elementFace.push_back(f);
+                elementNodes.insert(elementNodes.end(), &faceIndices[3*f], &faceIndices[3*f] + 3);
+            }
+            colorStart.push_back((int)elementFace.size());
+        }
+        int count = elementCount();
+        inv00.resize(count);
+        inv01.resize(count);
+        inv10.resize(count);
+        inv11.resize(count);
+        area.resize(count);
+        std::vector<double> shortest(count);
+        parallelFor(0, count, [&](int e) {
+            const int* n = &elementNodes[3*e];
+            /** Rest edges in an orthonormal frame of the triangle's plane **/
+            Vec3 d1 = rest[n[1]] - rest[n[0]], d2 = rest[n[2]] - rest[n[0]];
+            T len = d1.length();
+            Vec3 u = d1 / len;
+            Vec3 w = Vec3::cross(Vec3::cross(d1, d2), d1);
+            w = w / w.length();
+            T a = len, b = Vec3::dot(d2, u), c = 0, d = Vec3::dot(d2, w); // Dm = [a b; c d]
+            T det = a * d - b * c;
+            inv00[e] = d / det;
+            inv01[e] = -b / det;
+            inv10[e] = -c / det;
+            inv11[e] = a / det;
+            area[e] = fabs(det) / 2;
+            shortest[e] = std::min(std::min(len, d2.length()), (rest[n[2]] - rest[n[1]]).length());
+        });
+        minEdge = INFINITY;
+        for (int e = 0; e < count; e ++) { minEdge = std::min(minEdge, shortest[e]); }
+    }
+
+    /** A removed face keeps its slot with no area, so it produces no force **/
+    void removeFace(int f)
+    {
+        if (!active() || faceElement[f] < 0) return;
+        area[faceElement[f]] = 0;
+    }
+
+    void apply(const std::vector<Node*>& nodes)
+    {
+        if (threadPool.size() == 1) {
+            for (int e = 0; e < elementCount(); e += Lanes) { applyBatch(nodes, e, std::min(e + Lanes, elementCount())); }
+            return;
+        }
+        for (int c = 0; c + 1 < colorStart.size(); c ++) { // No two elements of a color share a node
+            int begin = colorStart[c], end = colorStart[c + 1];
+            parallelFor(0, (end - begin + Lanes - 1) / Lanes, [&](int b) {
+                applyBatch(nodes, begin + b * Lanes, std::min(begin + (b + 1) * Lanes, end));
+            });
+        }
+    }
+
+    /** Elements [begin, end), at most Lanes of them **/
+    void applyBatch(const std::vector<Node*>& nodes, int begin, int end)
+    {
+        int count = end - begin;
+        T x[3][3][Lanes], v[3][3][Lanes];   // [node][axis][lane]
+        T m00[Lanes], m01[Lanes], m10[Lanes], m11[Lanes], a[Lanes];
+        for (int l = 0; l < Lanes; l ++) {
+            int e = begin + std::min(l, count - 1); // Spare lanes repeat the last element with no area
+            const int* n = &elementNodes[3*e];
+            bool asleep = nodes[n[0]]->isAsleep && nodes[n[1]]->isAsleep && nodes[n[2]]->isAsleep;
+            for (int k = 0; k < 3; k ++) {
+                const Node* node = nodes[n[k]];
+                x[k][0][l] = node->position.x;
+                x[k][1][l] = node->position.y;
+                x[k][2][l] = node->position.z;
+                v[k][0][l] = node->velocity.x;
+                v[k][1][l] = node->velocity.y;
+                v[k][2][l] = node->velocity.z;
+            }
+            m00[l] = inv00[e];
+            m01[l] = inv01[e];
+            m10[l] = inv10[e];
+            m11[l] = inv11[e];
+            a[l] = l < count && !asleep ? area[e] : 0;
+        }
+
+        /** Deformation gradient F = Ds Dm^-1 and its rate, column by column **/
+        T f0[3][Lanes], f1[3][Lanes], g0[3][Lanes], g1[3][Lanes];
+        for (int i = 0; i < 3; i ++) {
+            for (int l = 0; l < Lanes; l ++) {
+                T d1 = x[1][i][l] - x[0][i][l], d2 = x[2][i][l] - x[0][i][l];
+                T w1 = v[1][i][l] - v[0][i][l], w2 = v[2][i][l] - v[0][i][l];
+                f0[i][l] = d1 * m00[l] + d2 * m10[l];
+                f1[i][l] = d1 * m01[l] + d2 * m11[l];
+                g0[i][l] = w1 * m00[l] + w2 * m10[l];
+                g1[i][l] = w1 * m01[l] + w2 * m11[l];
+            }
+        }
+
+        /** Stress as P = F S + R Q, S and Q symmetric 2x2: S of StVK, Q of the co-rotated model and damping **/
+        T s00[Lanes], s01[Lanes], s11[Lanes], q00[Lanes], q01[Lanes], q11[Lanes], r0[3][Lanes], r1[3][Lanes];
+        T stretch[Lanes];
+        bool tearing = tearStretch > 0.0;
+        for (int l = 0; l < Lanes; l ++) {
+            T c00 = 0, c01 = 0, c11 = 0;
+            for (int i = 0; i < 3; i ++) {
+                c00 += f0[i][l] * f0[i][l];
+                c01 += f0[i][l] * f1[i][l];
+                c11 += f1[i][l] * f1[i][l];
+            }
+            T half = (c00 + c11) / 2, diff = (c00 - c11) / 2;
+            stretch[l] = tearing ? half + sqrt(diff * diff + c01 * c01) : 0; // Largest eigenvalue of F^T F
+            /** Polar decomposition: S = sqrt(F^T F) = (F^T F + root I) / t in closed form, R = F S^-1 **/
+            T det = c00 * c11 - c01 * c01;
+            bool collapsed = det <= (T)1e-12; // R = F then
+            T root = collapsed ? 1 : sqrt(det), t = sqrt(c00 + c11 + 2 * root);
+            T scale = collapsed ? 1 : 1 / (t * root); // det S = root
+            T u00 = collapsed ? 1 : (c11 + root) * scale, u01 = collapsed ? 0 : -c01 * scale, u11 = collapsed ? 1 : (c00 + root) * scale;
+            T trace = collapsed ? 2 : t;
+            T d00 = 0, d01 = 0, d11 = 0;
+            for (int i = 0; i < 3; i ++) {
+                r0[i][l] = f0[i][l] * u00 + f1[i][l] * u01;
+                r1[i][l] = f0[i][l] * u01 + f1[i][l] * u11;
+                d00 += r0[i][l] * g0[i][l];
+                d01 += (r0[i][l] * g1[i][l] + r1[i][l] * g0[i][l]) / 2;
+                d11 += r1[i][l] * g1[i][l];
+            }
+            T rate = 2 * damping;
+            if (corotated) { // 2 mu F - (2 mu - lambda (tr S - 2)) R
+                T rotation = lambda * (trace - 2) - 2 * mu;
+                s00[l] = 2 * mu;
+                s01[l] = 0;
+                s11[l] = 2 * mu;
+                q00[l] = rotation + rate * d00;
+                q11[l] = rotation + rate * d11;
+            } else { // F (2 mu E + lambda tr(E) I)
+                T strain = (c00 + c11 - 2) / 2;
+                s00[l] = mu * (c00 - 1) + lambda * strain;
+                s01[l] = mu * c01;
+                s11[l] = mu * (c11 - 1) + lambda * strain;
+                q00[l] = rate * d00;
+                q11[l] = rate * d11;
+            }
+            q01[l] = rate * d01;
+        }
+
+        /** Forces of nodes 1 and 2: -A P Dm^-T **/
+        T h1[3][Lanes], h2[3][Lanes];
+        for (int i = 0; i < 3; i ++) {
+            for (int l = 0; l < Lanes; l ++) {
+                T p0 = f0[i][l] * s00[l] + f1[i][l] * s01[l] + r0[i][l] * q00[l] + r1[i][l] * q01[l];
+                T p1 = f0[i][l] * s01[l] + f1[i][l] * s11[l] + r0[i][l] * q01[l] + r1[i][l] * q11[l];
+                h1[i][l] = -a[l] * (p0 * m00[l] + p1 * m01[l]);
+                h2[i][l] = -a[l] * (p0 * m10[l] + p1 * m11[l]);
+            }
+        }
+        for (int l = 0; l < count; l ++) {
+            const int* n = &elementNodes[3*(begin + l)];
+            Vec3 force1(h1[0][l], h1[1][l], h1[2][l]), force2(h2[0][l], h2[1][l], h2[2][l]);
+            nodes[n[1]]->force += force1;
+            nodes[n[2]]->force += force2;
+            nodes[n[0]]->force -= force1 + force2;
+            checkStretch(nodes, begin + l, stretch[l] * (a[l] > 0));
+        }
+    }
+
+    /** stretch is the squared principal stretch **/
+    void checkStretch(const std::vector<Node*>& nodes, int e, T stretch)
+    {
+        if (tearStretch <= 0.0 || stretch <= tearStretch * tearStretch) return;
+        const int* n = &elementNodes[3*e];
+        if (nodes[n[0]]->isFixed || nodes[n[1]]->isFixed || nodes[n[2]]->isFixed) return; // Pins start stretched
+        std::lock_guard<std::mutex> lock(tearLock);
+        tornFaces.push_back(elementFace[e]);
+    }
+
+    /** Gershgorin bound of the element stiffness, added like springs: half the row sum stands for sum(k) **/
+    // (lambda + 2 mu) A |g_i| sum_j |g_j|, g_i the gradient of the shape function of node i, bounds the co-rotated
+    // element anywhere. StVK stiffens by about (3 s^2 - 1) / 2 under a stretch s, so its bound takes the current
+    // stretch and has to be refreshed as the cloth moves, see SimulationT::frame.
+    void addStability(const std::vector<Node*>& nodes, std::vector<double>& stiffness, std::vector<double>& dampingSum) const
+    {
+        for (int e = 0; e < elementCount(); e ++) {
+            double stiffening = 1.0;
+            if (!corotated) {
+                const int* n = &elementNodes[3*e];
+                Vec3 d1 = nodes[n[1]]->position - nodes[n[0]]->position, d2 = nodes[n[2]]->position - nodes[n[0]]->position;
+                Vec3 f0 = d1 * inv00[e] + d2 * inv10[e], f1 = d1 * inv01[e] + d2 * inv11[e];
+                double c00 = Vec3::dot(f0, f0), c01 = Vec3::dot(f0, f1), c11 = Vec3::dot(f1, f1);
+                double stretch = (c00 + c11) / 2 + sqrt((c00 - c11) * (c00 - c11) / 4 + c01 * c01);
+                stiffening = std::max(1.0, 1.5 * stretch - 0.5);
+            }
+            double g[3][2] = { { -inv00[e] - inv10[e], -inv01[e] - inv11[e] }, { inv00[e], inv01[e] }, { inv10[e], inv11[e] } };
+            double norm[3], total = 0.0;
+            for (int k = 0; k < 3; k ++) {
+                norm[k] = sqrt(g[k][0] * g[k][0] + g[k][1] * g[k][1]);
+                total += norm[k];
+            }
+            for (int k = 0; k < 3; k ++) {
+                double row = area[e] * norm[k] * total / 2.0;
+                stiffness[elementNodes[3*e+k]] += stiffening * (lambda + 2.0 * mu) * row;
+                dampingSum[elementNodes[3*e+k]] += 2.0 * damping * row;
+            }
+        }
+    }
+};
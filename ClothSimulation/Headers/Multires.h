@@ -0,0 +1,325 @@
+#pragma once
+
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "Simulation.h"
+
+/** Dense cloth reconstructed every frame from a coarse simulated one **/
+// The fine cloth is an ordinary ClothT with factor times the density, so ClothRender and ClothSpringRender draw
+// it like any other cloth. Its nodes follow the coarse nodes by Catmull-Rom subdivision, plus wrinkles along
+// the normal where the coarse cloth is compressed. With detailPhysics the fine tiles near the ball run their own
+// substeps instead, held at their border by the subdivided nodes around them and pulled softly after the
+// subdivided motion, so impulses, wind and drag that only the coarse cloth feels carry over. One way: the coarse
+// cloth does not feel the fine one.
+template <typename T>
+struct MultiresClothT
+{
+    typedef Vec3T<T> Vec3;
+    typedef NodeT<T> Node;
+    typedef SpringT<T> Spring;
+    typedef ClothT<T> Cloth;
+    typedef SimulationT<T> Simulation;
+
+    Simulation* coarse;
+    int factor;
+    Cloth fine;
+    Simulation fineSimulation;      // Stability bound, gravity and colliders of the fine cloth, the substeps are run here
+
+    double wrinkleScale = 1.0;      // 0 turns the wrinkle pass off
+    double wrinkleLength;           // Wavelength of the wrinkles, one coarse spacing unless set
+    bool detailPhysics = false;     // Simulate the fine tiles near the ball
+    double detailMargin = 0.5;      // Distance to the ball that turns a tile on
+    double detailFollow = 0.1;      // Time constant of the pull of simulated nodes after the subdivided motion, s
+    int detailHold = 10;            // Frames a tile stays on after leaving the margin, so the border does not flicker
+
+    /** Subdivision, separable: 4 clamped coarse taps and Catmull-Rom weights per fine column and per fine row **/
+    std::vector<int> tapX, tapY;
+    std::vector<T> weightX, weightY;
+    std::vector<int> cellX, cellY;  // Coarse cell and position in it, for the bilinear wrinkle fields
+    std::vector<T> fracX, fracY;
+    std::vector<T> waveX, waveY;    // sin(2 pi u / wrinkleLength) at the rest coordinate of each fine column / row
+    std::vector<Vec3> coarsePos;    // Coarse grid, grid order
+    std::vector<Vec3> coarseNormal;
+    std::vector<T> squeezeX, squeezeY; // sqrt of the compression of the coarse cloth along x / y, 0 when stretched
+    std::vector<Vec3> rows;         // Coarse rows subdivided along x
+    std::vector<Vec3> target;       // Subdivided positions without wrinkles, fine grid order
+    std::vector<Vec3> lastTarget;
+    bool hasLastTarget = false;
+
+    /** Detail physics **/
+    std::vector<int> tileHold;      // Frames left for each fine tile to be simulated, 0 when it is driven
+    std::vector<char> simulated;    // Per fine node
+    std::vector<int> springEnds;    // Node indices of both ends of each fine spring
+    std::vector<int> nodeGrid;      // Fine grid cell of each fine node
+    std::vector<int> activeNodes;
+    std::vector< std::vector<int> > activeSpringColors; // Fine springs with a simulated end, by color
+    int activeTiles = 0;
+    int detailSubsteps = 0;         // Fine substeps of the last frame
+
+    MultiresClothT(Simulation* c, int f, typename Cloth::NodeOrderEnum order = Cloth::ORDER_GRID)
+    : coarse(c), factor(f),
+      fine(c->cloth->clothPos, Vec2(c->cloth->width, c->cloth->height), c->cloth->nodesDensity * f),
+      fineSimulation(&fine, c->ground, c->ball, c->timeStep)
+    {
+        Cloth* cloth = coarse->cloth;
+        fine.reorder(order);
+        int nc = cloth->nodesPerRow, mc = cloth->nodesPerCol;
+        int nf = fine.nodesPerRow, mf = fine.nodesPerCol;
+        double spacing = 1.0 / cloth->nodesDensity;
+        wrinkleLength = spacing;
+        mapAxis(nc, nf, tapX, weightX, cellX, fracX);
+        mapAxis(mc, mf, tapY, weightY, cellY, fracY);
+
+        /** Rest state: the subdivided coarse rest grid, the layout of ClothT::init, at the same mass per area **/
+        T mass = cloth->nodes[0]->mass / (factor * factor);
+        for (int y = 0; y < mf; y ++) {
+            for (int x = 0; x < nf; x ++) {
+                Node* n = fine.getNode(x, y);
+                n->position = Vec3((cellX[x] + fracX[x]) * spacing, -(cellY[y] + fracY[y]) * spacing, 0.0);
+                n->isFixed = false;
+                n->mass = mass;
+            }
+        }
+        for (int i = 0; i < fine.springs.size(); i ++) {
+            Spring* s = fine.springs[i];
+            s->restLen = (s->node2->position - s->node1->position).length();
+        }
+        fine.computeNormal();
+        fineSimulation.estimateStability();
+
+        coarsePos.resize(nc*mc);
+        coarseNormal.resize(nc*mc);
+        squeezeX.resize(nc*mc);
+        squeezeY.resize(nc*mc);
+        rows.resize(mc*nf);
+        target.resize(nf*mf);
+        setWrinkleLength(wrinkleLength);
+
+        typename Cloth::NodeIndex index = fine.nodeIndices();
+        springEnds.resize(2*fine.springs.size());
+        for (int i = 0; i < fine.springs.size(); i ++) {
+            springEnds[2*i] = index[fine.springs[i]->node1];
+            springEnds[2*i+1] = index[fine.springs[i]->node2];
+        }
+        nodeGrid.resize(fine.nodes.size());
+        for (int i = 0; i < fine.gridNodes.size(); i ++) { nodeGrid[fine.gridNodes[i]] = i; }
+        tileHold.assign(fine.tiles.size(), 0);
+        simulated.assign(fine.nodes.size(), 0);
+    }
+
+    /** Fine position i in coarse grid units, its cell, and the Catmull-Rom taps around it **/
+    static void mapAxis(int coarseCount, int fineCount, std::vector<int>& tap, std::vector<T>& weight, std::vector<int>& cell, std::vector<T>& frac)
+    {
+        tap.resize(4*fineCount);
+        weight.resize(4*fineCount);
+        cell.resize(fineCount);
+        frac.resize(fineCount);
+        for (int i = 0; i < fineCount; i ++) {
+            double u = fineCount > 1 ? (double)i * (coarseCount - 1) / (fineCount - 1) : 0.0;
+            int c = std::max(0, std::min((int)u, coarseCount - 2));
+            T t = u - c;
+            cell[i] = c;
+            frac[i] = t;
+            for (int k = 0; k < 4; k ++) { tap[4*i+k] = std::max(0, std::min(coarseCount - 1, c - 1 + k)); }
+            weight[4*i+0] = 0.5 * (-t + 2*t*t - t*t*t);
+            weight[4*i+1] = 0.5 * (2 - 5*t*t + 3*t*t*t);
+            weight[4*i+2] = 0.5 * (t + 4*t*t - 3*t*t*t);
+            weight[4*i+3] = 0.5 * (-t*t + t*t*t);
+        }
+    }
+
+    void setWrinkleLength(double length)
+    {
+        wrinkleLength = length;
+        double spacing = 1.0 / coarse->cloth->nodesDensity;
+        waveX.resize(cellX.size());
+        waveY.resize(cellY.size());
+        for (int x = 0; x < waveX.size(); x ++) { waveX[x] = sin(2.0 * M_PI * (cellX[x] + fracX[x]) * spacing / length); }
+        for (int y = 0; y < waveY.size(); y ++) { waveY[y] = sin(2.0 * M_PI * (cellY[y] + fracY[y]) * spacing / length); }
+    }
+
+    /** After every coarse frame **/
+    void update()
+    {
+        double frameTime = coarse->cloth->iterationFreq * coarse->timeStep;
+        { TRACE_ZONE("subdivide"); subdivide(); }
+        if (hasLastTarget && (detailPhysics || activeTiles > 0)) { TRACE_ZONE("chooseDetail"); chooseDetail(); }
+        { TRACE_ZONE("drive"); drive(frameTime); }
+        if (activeTiles > 0) { TRACE_ZONE("simulateDetail"); simulateDetail(frameTime); }
+        { TRACE_ZONE("fineNormal"); fine.computeNormal(); }
+        lastTarget.swap(target);
+        target.resize(lastTarget.size());
+        hasLastTarget = true;
+    }
+
+    void subdivide()
+    {
+        Cloth* cloth = coarse->cloth;
+        int nc = cloth->nodesPerRow, mc = cloth->nodesPerCol, nf = fine.nodesPerRow, mf = fine.nodesPerCol;
+        parallelFor(0, mc, [&](int y) {
+            for (int x = 0; x < nc; x ++) {
+                Node* n = cloth->nodes[cloth->gridNode(x, y)];
+                coarsePos[y*nc+x] = n->position;
+                coarseNormal[y*nc+x] = n->normal;
+            }
+        });
+        if (wrinkleScale > 0.0) {
+            double spacing = 1.0 / cloth->nodesDensity;
+            parallelFor(0, mc, [&](int y) {
+                for (int x = 0; x < nc; x ++) {
+                    int x0 = std::max(0, x-1), x1 = std::min(nc-1, x+1);
+                    int y0 = std::max(0, y-1), y1 = std::min(mc-1, y+1);
+                    T lenX = (coarsePos[y*nc+x1] - coarsePos[y*nc+x0]).length() / ((x1 - x0) * spacing);
+                    T lenY = (coarsePos[y1*nc+x] - coarsePos[y0*nc+x]).length() / ((y1 - y0) * spacing);
+                    squeezeX[y*nc+x] = sqrt(std::max((T)0.0, 1 - lenX));
+                    squeezeY[y*nc+x] = sqrt(std::max((T)0.0, 1 - lenY));
+                }
+            });
+        }
+        parallelFor(0, mc, [&](int y) {
+            const Vec3* row = &coarsePos[y*nc];
+            for (int x = 0; x < nf; x ++) {
+                const int* tap = &tapX[4*x];
+                const T* w = &weightX[4*x];
+                Vec3 p = row[tap[0]] * w[0];
+                for (int k = 1; k < 4; k ++) { p.axpy(w[k], row[tap[k]]); }
+                rows[y*nf+x] = p;
+            }
+        });
+        parallelFor(0, mf, [&](int y) {
+            const int* tap = &tapY[4*y];
+            const T* w = &weightY[4*y];
+            for (int x = 0; x < nf; x ++) {
+                Vec3 p = rows[tap[0]*nf+x] * w[0];
+                for (int k = 1; k < 4; k ++) { p.axpy(w[k], rows[tap[k]*nf+x]); }
+                target[y*nf+x] = p;
+            }
+        });
+    }
+
+    /** A sheet compressed by c folds into waves of amplitude wrinkleLength * sqrt(c) / pi, keeping its length **/
+    Vec3 wrinkle(int x, int y) const
+    {
+        int nc = coarse->cloth->nodesPerRow;
+        int i = cellY[y]*nc + cellX[x];
+        T fx = fracX[x], fy = fracY[y];
+        T w[4] = { (1-fx)*(1-fy), fx*(1-fy), (1-fx)*fy, fx*fy };
+        int c[4] = { i, i+1, i+nc, i+nc+1 };
+        T sx = 0, sy = 0;
+        Vec3 normal;
+        for (int k = 0; k < 4; k ++) {
+            sx += w[k] * squeezeX[c[k]];
+            sy += w[k] * squeezeY[c[k]];
+            normal.axpy(w[k], coarseNormal[c[k]]);
+        }
+        normal.normalize();
+        return normal * (T)(wrinkleScale * wrinkleLength / M_PI * (sx * waveX[x] + sy * waveY[y]));
+    }
+
+    /** Fine nodes outside the simulated tiles take the subdivided state **/
+    void drive(double frameTime)
+    {
+        int nf = fine.nodesPerRow;
+        T invFrame = 1.0 / frameTime;
+        parallelFor(0, fine.nodesPerCol, [&](int y) {
+            for (int x = 0; x < nf; x ++) {
+                int i = fine.gridNode(x, y);
+                if (simulated[i]) continue;
+                Node* n = fine.nodes[i];
+                const Vec3& p = target[y*nf+x];
+                n->position = wrinkleScale > 0.0 ? p + wrinkle(x, y) : p;
+                if (hasLastTarget) n->velocity = (p - lastTarget[y*nf+x]) * invFrame;
+                n->force.setZeroVec(); // Springs of simulated neighbours pull at it, it does not move by them
+            }
+        });
+    }
+
+    /** Tiles whose subdivided nodes come within detailMargin of the ball are simulated **/
+    // The ground is flat, the coarse cloth already lies on it as well as the fine one would.
+    void chooseDetail()
+    {
+        Ball* ball = coarse->ball;
+        double reach = ball->radius*1.05 + detailMargin;
+        Vec3T<double> clothPos = fine.clothPos;
+        int nf = fine.nodesPerRow;
+        bool changed = false;
+        for (int t = 0; t < fine.tiles.size(); t ++) {
+            const ClothTile& tile = fine.tiles[t];
+            bool near = false;
+            for (int y = tile.tileY*fine.tileSize; !near && y < std::min(fine.nodesPerCol, (tile.tileY+1)*fine.tileSize); y ++) {
+                for (int x = tile.tileX*fine.tileSize; x < std::min(nf, (tile.tileX+1)*fine.tileSize); x ++) {
+                    Vec3T<double> p = clothPos + target[y*nf+x];
+                    if (detailPhysics && (p - ball->center).length() < reach) {
+                        near = true;
+                        break;
+                    }
+                }
+            }
+            int hold = near ? detailHold : std::max(0, tileHold[t] - 1);
+            if ((hold > 0) != (tileHold[t] > 0)) changed = true;
+            tileHold[t] = hold;
+        }
+        if (changed) rebuildActive();
+    }
+
+    /** Node and spring lists of the simulated tiles, rebuilt only when a tile turns on or off **/
+    void rebuildActive()
+    {
+        activeTiles = 0;
+        activeNodes.clear();
+        for (int t = 0; t < fine.tiles.size(); t ++) {
+            bool on = tileHold[t] > 0;
+            if (on) activeTiles ++;
+            const std::vector<int>& nodes = fine.tiles[t].nodes;
+            for (int i = 0; i < nodes.size(); i ++) {
+                simulated[nodes[i]] = on;
+                if (on) activeNodes.push_back(nodes[i]);
+            }
+        }
+        std::sort(activeNodes.begin(), activeNodes.end());
+        activeSpringColors.assign(fine.springColors.size(), std::vector<int>());
+        for (int c = 0; c < fine.springColors.size(); c ++) {
+            const std::vector<int>& color = fine.springColors[c];
+            for (int i = 0; i < color.size(); i ++) {
+                int s = color[i];
+                if (simulated[springEnds[2*s]] || simulated[springEnds[2*s+1]]) activeSpringColors[c].push_back(s);
+            }
+        }
+    }
+
+    /** The fine cloth is lighter per node, so its stable step is shorter than the coarse one **/
+    void simulateDetail(double frameTime)
+    {
+        double step = fineSimulation.safety * fineSimulation.stableStep;
+        detailSubsteps = std::max(coarse->substeps, (int)ceil(frameTime / step));
+        double dt = frameTime / detailSubsteps;
+        Vec3 gravity = fineSimulation.gravity;
+        T stiffness = 1.0 / (detailFollow * detailFollow), damping = 2.0 / detailFollow; // Critically damped, per mass
+        T invFrame = 1.0 / frameTime;
+        for (int s = 0; s < detailSubsteps; s ++) {
+            T along = (T)(s + 1) / detailSubsteps; // Through the frame, from the last subdivided state to this one
+            parallelFor(0, (int)activeNodes.size(), [&](int i) {
+                int g = nodeGrid[activeNodes[i]];
+                Node* n = fine.nodes[activeNodes[i]];
+                Vec3 goal = lastTarget[g] + (target[g] - lastTarget[g]) * along;
+                Vec3 goalVelocity = (target[g] - lastTarget[g]) * invFrame;
+                fine.addNodeForce(activeNodes[i], gravity, false);
+                n->force.axpy(n->mass * stiffness, goal - n->position);
+                n->force.axpy(n->mass * damping, goalVelocity - n->velocity);
+            });
+            for (int c = 0; c < activeSpringColors.size(); c ++) {
+                std::vector<int>& color = activeSpringColors[c];
+                parallelFor(0, (int)color.size(), [&](int i) { fine.springs[color[i]]->applyInternalForce(dt); });
+            }
+            parallelFor(0, (int)activeNodes.size(), [&](int i) {
+                fine.nodes[activeNodes[i]]->integrate(dt);
+                fine.collideNode(activeNodes[i], coarse->ground, coarse->ball);
+            });
+        }
+    }
+};
+
+typedef MultiresClothT<Scalar> MultiresCloth;
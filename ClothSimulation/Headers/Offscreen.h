@@ -0,0 +1,351 @@
+#pragma once
+
+#include <glad/glad.h>
+#ifdef __linux__
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Display.h"
+#include "Export.h"
+#include "Log.h"
+#include "Simulation.h"
+#include "Trace.h"
+
+/** OpenGL 3.3 core context without a window, display or GPU **/
+// EGL on Mesa's surfaceless platform needs neither X nor a DRM device and falls back to llvmpipe, the default EGL
+// display is tried next (a GPU driver or a headless X server). Nothing is drawn to a surface, OffscreenTarget is
+// the framebuffer. There is no EGL on macOS, use the window there.
+struct OffscreenContext
+{
+#ifdef __linux__
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+#endif
+
+    bool create()
+    {
+#ifdef __linux__
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay) display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+            if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+                LOG_ERROR("Headless : No EGL display.\n");
+                return false;
+            }
+        }
+        const char* extensions = eglQueryString(display, EGL_EXTENSIONS);
+        if (!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context")) {
+            LOG_ERROR("Headless : EGL_KHR_surfaceless_context is not supported.\n");
+            return false;
+        }
+        eglBindAPI(EGL_OPENGL_API);
+
+        const EGLint configAttribs[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+        EGLConfig config;
+        EGLint configCount = 0;
+        if (!eglChooseConfig(display, configAttribs, &config, 1, &configCount) || configCount == 0) {
+            LOG_ERROR("Headless : No EGL config for desktop OpenGL.\n");
+            return false;
+        }
+        const EGLint contextAttribs[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 3,
+            EGL_CONTEXT_MINOR_VERSION, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+        if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+            LOG_ERROR("Headless : Failed to create an OpenGL 3.3 core context.\n");
+            return false;
+        }
+        if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) {
+            LOG_ERROR("Failed to initialize GLAD.\n");
+            return false;
+        }
+        LOG_INFO("Headless : %s, %s\n", (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION));
+        return true;
+#else
+        LOG_ERROR("Headless : Offscreen contexts need EGL, which is only available on Linux.\n");
+        return false;
+#endif
+    }
+
+    void destroy()
+    {
+#ifdef __linux__
+        if (display == EGL_NO_DISPLAY) return;
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+        eglTerminate(display);
+        display = EGL_NO_DISPLAY;
+        context = EGL_NO_CONTEXT;
+#endif
+    }
+};
+
+/** Framebuffer object with color and depth renderbuffers, what the window's back buffer is otherwise **/
+struct OffscreenTarget
+{
+    int width, height;
+    GLuint fboID = 0;
+    GLuint colorID = 0;
+    GLuint depthID = 0;
+
+    bool create(int w, int h)
+    {
+        width = w;
+        height = h;
+        glGenFramebuffers(1, &fboID);
+        glGenRenderbuffers(1, &colorID);
+        glGenRenderbuffers(1, &depthID);
+
+        glBindRenderbuffer(GL_RENDERBUFFER, colorID);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthID);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, fboID);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorID);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthID);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            LOG_ERROR("Headless : Framebuffer %dx%d is not complete.\n", width, height);
+            return false;
+        }
+        glViewport(0, 0, width, height);
+        return true;
+    }
+
+    void bind()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, fboID);
+        glViewport(0, 0, width, height);
+    }
+
+    void destroy()
+    {
+        if (!fboID) return;
+        glDeleteFramebuffers(1, &fboID);
+        glDeleteRenderbuffers(1, &colorID);
+        glDeleteRenderbuffers(1, &depthID);
+        fboID = 0;
+    }
+};
+
+/** Asynchronous readback through a ring of pixel buffer objects **/
+// glReadPixels into a bound GL_PIXEL_PACK_BUFFER only queues a copy on the GPU and returns at once, a fence marks
+// when it is done. A frame's buffer is mapped frames later, when it comes around the ring again or earlier if its
+// fence has already passed, so the render loop never waits for the copy of the frame it just drew. Waits that do
+// happen (the ring is too shallow for the driver) are counted in stalls.
+struct PixelReader
+{
+    typedef std::function<void(long long, const unsigned char*)> Sink; // Frame index and RGBA rows, bottom row first
+
+    int width, height;
+    std::vector<GLuint> bufferIDs;
+    std::vector<GLsync> fences;
+    std::vector<long long> frameOf;  // Frame read into each buffer, -1 when free
+    int head = 0;                    // Next buffer to read into, the oldest in flight
+    long long stalls = 0;
+
+    void init(int w, int h, int depth = 3)
+    {
+        width = w;
+        height = h;
+        bufferIDs.resize(depth);
+        fences.assign(depth, (GLsync)0);
+        frameOf.assign(depth, -1);
+        glGenBuffers(depth, &bufferIDs[0]);
+        for (int i = 0; i < depth; i ++) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, bufferIDs[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, NULL, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    /** Queues the copy of the bound framebuffer, hands frames read before to sink in order **/
+    void capture(long long frame, const Sink& sink)
+    {
+        TRACE_ZONE("readback");
+        // Oldest first: the buffer at head is needed now, the ones after it only if their copy already finished
+        for (int k = 0; k < bufferIDs.size(); k ++) {
+            int i = (head + k) % bufferIDs.size();
+            if (frameOf[i] < 0) continue;
+            if (k > 0 && glClientWaitSync(fences[i], 0, 0) == GL_TIMEOUT_EXPIRED) break;
+            finish(i, sink);
+        }
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, bufferIDs[head]);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        fences[head] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        frameOf[head] = frame;
+        head = (head + 1) % bufferIDs.size();
+    }
+
+    /** Hands every frame still in flight to sink, call after the last capture **/
+    void flush(const Sink& sink)
+    {
+        for (int k = 0; k < bufferIDs.size(); k ++) {
+            int i = (head + k) % bufferIDs.size();
+            if (frameOf[i] >= 0) finish(i, sink);
+        }
+    }
+
+    void finish(int i, const Sink& sink)
+    {
+        if (glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED) {
+            stalls ++;
+            while (glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+        }
+        glDeleteSync(fences[i]);
+        fences[i] = 0;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, bufferIDs[i]);
+        const unsigned char* pixels = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)width * height * 4, GL_MAP_READ_BIT);
+        if (pixels) sink(frameOf[i], pixels);
+        else LOG_ERROR("Headless : Failed to map the pixels of frame %lld.\n", frameOf[i]);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        frameOf[i] = -1;
+    }
+
+    void destroy()
+    {
+        for (int i = 0; i < fences.size(); i ++) {
+            if (fences[i]) glDeleteSync(fences[i]);
+        }
+        if (!bufferIDs.empty()) glDeleteBuffers((GLsizei)bufferIDs.size(), &bufferIDs[0]);
+        bufferIDs.clear();
+    }
+};
+
+/** --headless: renders the simulation offscreen to an image sequence, no window **/
+// One simulation frame per output frame, so the sequence is the same on any machine. The passes are the window's
+// (cloth, ball, ground) drawn into an OffscreenTarget, read back by a PixelReader and written by the export queue
+// of exporter, along with any mesh or trajectory export.
+struct HeadlessRender
+{
+    bool enabled = false;
+    int frames = 240;
+    int width = 800;
+    int height = 800;
+    int fps = 30;                       // Of the Y4M stream
+    double turntable = 0.0;             // Degrees the camera orbits the ball per frame
+    std::string output = "frame_%05d.png";
+
+    /** --headless --frames=240 --width=800 --height=800 --output=frames/frame_%05d.png|cloth.y4m --fps=30 --turntable=1.5 **/
+    bool parseArgs(int argc, const char* argv[])
+    {
+        for (int i = 1; i < argc; i ++) {
+            if (strcmp(argv[i], "--headless") == 0) enabled = true;
+            sscanf(argv[i], "--frames=%d", &frames);
+            sscanf(argv[i], "--width=%d", &width);
+            sscanf(argv[i], "--height=%d", &height);
+            sscanf(argv[i], "--fps=%d", &fps);
+            sscanf(argv[i], "--turntable=%lf", &turntable);
+            if (strncmp(argv[i], "--output=", 9) == 0) output = argv[i] + 9;
+        }
+        return enabled;
+    }
+
+    int run(Simulation& simulation, ClothExporter& exporter)
+    {
+        bool y4m = output.size() > 4 && output.compare(output.size() - 4, 4, ".y4m") == 0;
+        if (!y4m && !ClothExporter::checkPattern(output, "--output")) return 1;
+        OffscreenContext context;
+        if (!context.create()) return 1;
+
+        // Every path after the context exists ends below, so a failure never leaks the framebuffer or the context
+        int status = 1;
+        OffscreenTarget target;
+        ExportQueue& exports = *exporter.queue;
+        if (target.create(width, height) && (!y4m || exports.openStream(output, width, height, fps))) {
+            status = render(simulation, exporter, target, y4m);
+        }
+        target.destroy();
+        context.destroy();
+        return status;
+    }
+
+    /** The frames into target, renderers live only as long as this **/
+    int render(Simulation& simulation, ClothExporter& exporter, OffscreenTarget& target, bool y4m)
+    {
+        cam.uniProjMatrix = glm::perspective(glm::radians(45.0f), (float)width / height, 0.1f, 100.0f);
+        glEnable(GL_DEPTH_TEST);
+        glPointSize(3);
+
+        int status = 0;
+        {
+            ClothRender clothRender(simulation.cloth);
+            BallRender ballRender(simulation.ball);
+            GroundRender groundRender(simulation.ground);
+
+            ExportQueue& exports = *exporter.queue;
+            exports.start();
+            PixelReader reader;
+            reader.init(width, height);
+            PixelReader::Sink sink = [&](long long frame, const unsigned char* rgba) {
+                ExportJob* job = exports.acquire();
+                job->kind = y4m ? ExportJob::IMAGE_Y4M : ExportJob::IMAGE_PNG;
+                job->index = frame;
+                job->path = y4m ? output : ClothExporter::format(output, frame);
+                job->width = width;
+                job->height = height;
+                job->pixels.assign(rgba, rgba + (size_t)width * height * 4);
+                job->positions.clear();
+                job->normals.clear();
+                job->texCoords.clear();
+                job->faces.clear();
+                exports.submit(job);
+            };
+
+            glm::vec3 center(simulation.ball->center.x, simulation.ball->center.y, simulation.ball->center.z);
+            glm::vec3 offset = cam.pos - center;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int f = 0; f < frames; f ++) {
+                simulation.frame();
+                exporter.frame(*simulation.cloth, f);
+                if (turntable != 0.0) { // Orbit around the vertical axis through the ball
+                    float angle = glm::radians((float)(turntable * f));
+                    cam.pos = center + glm::vec3(offset.x * cos(angle) + offset.z * sin(angle), offset.y,
+                                                 -offset.x * sin(angle) + offset.z * cos(angle));
+                    cam.front = center - cam.pos;
+                }
+
+                target.bind();
+                glClearColor(50.0f / 255, 50.0f / 255, 60.0f / 255, 1.0f); // The window's background
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                { TRACE_ZONE("clothRender.flush"); clothRender.flush(); }
+                { TRACE_ZONE("ballRender.flush"); ballRender.flush(); }
+                { TRACE_ZONE("groundRender.flush"); groundRender.flush(); }
+                reader.capture(f, sink);
+            }
+            reader.flush(sink);
+            exporter.flush();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            exports.finish();
+
+            LOG_INFO("Headless : %d frames rendered to %s in %.2f s (%.1f fps), %lld readback stalls\n",
+                     frames, output.c_str(), seconds, frames / seconds, reader.stalls);
+            exports.printSummary();
+            if (exports.failed > 0) status = 1;
+
+            reader.destroy();
+            clothRender.destroy();
+            ballRender.render.destroy();
+            groundRender.render.destroy();
+        }
+        return status;
+    }
+};
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Trace.h"
+
+/** Persistent worker pool, the calling thread always takes part in the work **/
+struct ThreadPool
+{
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable wakeCond;
+    std::condition_variable doneCond;
+
+    const std::function<void(int, int)>* job; // Body over a chunk [begin, end)
+    const char* zone;                         // Trace zone open on the caller, each worker records its share under it
+    std::atomic<int> next;                    // First index of the next chunk to hand out
+    int jobEnd;
+    int grain;
+    int busy;                                 // Workers that have not finished the current job
+    unsigned long generation;                 // Bumped once per job so workers can tell it apart
+    bool quit;
+
+    ThreadPool()
+    {
+        job = NULL;
+        zone = NULL;
+        next = 0;
+        jobEnd = 0;
+        grain = 1;
+        busy = 0;
+        generation = 0;
+        quit = false;
+    }
+    ~ThreadPool() { resize(1); }
+
+    int size() { return (int)workers.size() + 1; }
+
+    void resize(int threadCount) // Total number of threads including the caller
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            quit = true;
+        }
+        wakeCond.notify_all();
+        for (int i = 0; i < workers.size(); i ++) { workers[i].join(); }
+        workers.clear();
+
+        quit = false;
+        for (int i = 1; i < threadCount; i ++) {
+            workers.push_back(std::thread(&ThreadPool::workerLoop, this, generation));
+        }
+    }
+
+    void run(int begin, int end, int chunk, const std::function<void(int, int)>& body)
+    {
+        if (workers.empty() || end - begin <= chunk) {
+            body(begin, end);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            job = &body;
+            zone = TRACE_CURRENT();
+            next = begin;
+            jobEnd = end;
+            grain = chunk;
+            busy = (int)workers.size();
+            generation ++;
+        }
+        wakeCond.notify_all();
+        work();
+
+        std::unique_lock<std::mutex> guard(lock);
+        doneCond.wait(guard, [this] { return busy == 0; });
+        job = NULL;
+    }
+
+    void work()
+    {
+        for (;;) {
+            int b = next.fetch_add(grain);
+            if (b >= jobEnd) break;
+            (*job)(b, std::min(b + grain, jobEnd));
+        }
+    }
+
+    void workerLoop(unsigned long seen)
+    {
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wakeCond.wait(guard, [&] { return quit || generation != seen; });
+                if (quit) return;
+                seen = generation;
+            }
+            {
+                TRACE_JOB_ZONE(zone != NULL ? zone : "parallelFor");
+                work();
+            }
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (--busy == 0) doneCond.notify_one();
+            }
+        }
+    }
+};
+ThreadPool threadPool;
+
+/** Run body(i) for every i in [begin, end), serially when the pool has no workers **/
+template <typename Body>
+void parallelFor(int begin, int end, Body body)
+{
+    if (threadPool.size() == 1) {
+        for (int i = begin; i < end; i ++) { body(i); }
+        return;
+    }
+    int chunk = std::max(256, (end - begin) / (threadPool.size() * 8));
+    threadPool.run(begin, end, chunk, [&](int b, int e) {
+        for (int i = b; i < e; i ++) { body(i); }
+    });
+}
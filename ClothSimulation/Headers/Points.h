@@ -9,57 +9,60 @@ public:
     Vec3 normal;
     
     Vertex() {}
-    Vertex(Vec3 pos)
+    Vertex(const Vec3& pos)
     {
         position = pos;
     }
-    ~Vertex() {}
 };
 
-class Node
+template <typename T>
+class NodeT
 {
 public:
-    double  mass;           // In this project it will always be 1
+    typedef Vec2T<T> Vec2;
+    typedef Vec3T<T> Vec3;
+    
+    T       mass;           // In this project it will always be 1
     bool    isFixed;        // Use to pin the cloth
+    bool    isAsleep;       // Its tile came to rest, skipped until woken
     Vec2    texCoord;       // Texture coord
     Vec3    normal;         // For smoothly shading
 	Vec3	position;
     Vec3    velocity;
     Vec3    force;
-	Vec3	acceleration;
 
 public:
-    Node(void) {
+    NodeT(void) {
         mass = 1.0;
         isFixed = false;
+        isAsleep = false;
         velocity.setZeroVec();
         force.setZeroVec();
-        acceleration.setZeroVec();
     }
-	Node(Vec3 pos)
+	NodeT(const Vec3& pos)
     {
         mass = 1.0;
         isFixed = false;
+        isAsleep = false;
         position = pos;
         velocity.setZeroVec();
         force.setZeroVec();
-        acceleration.setZeroVec();
     }
-	~Node(void) {}
-
-	void addForce(Vec3 f)
+	void addForce(const Vec3& f)
 	{
         force += f;
 	}
 
-	void integrate(double timeStep) // Only non-fixed nodes take integration
+	void integrate(T timeStep) // Only non-fixed nodes take integration
 	{
 		if (!isFixed) // Verlet integration
 		{
-            acceleration = force/mass;
-            velocity += acceleration*timeStep;
-            position += velocity*timeStep;
+            Vec3 acceleration = force/mass;
+            velocity.axpy(timeStep, acceleration);
+            position.axpy(timeStep, velocity);
         }
         force.setZeroVec();
 	}
 };
+
+typedef NodeT<Scalar> Node;
@@ -10,6 +10,8 @@
 
 #include <unistd.h> // To use getcwd()
 
+#include "Log.h"
+
 class Program
 {
 public:
@@ -32,7 +34,7 @@ public:
             char currPath[256];
             char *currPathPtr = getcwd(currPath, sizeof(currPath));
             if (currPathPtr) {
-                std::cout << "Working at: " << currPath << std::endl;
+                LOG_DEBUG("Working at: %s\n", currPath);
             }
             // Open file
             vsFile.open(vsFilePath);
@@ -48,7 +50,7 @@ public:
             vsSrc = vsStream.str();
             fsSrc = fsStream.str();
         } catch (std::ifstream::failure e) {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ" << std::endl;
+            LOG_ERROR("SHADER::FILE_NOT_SUCCESSFULLY_READ\n");
         }
         
         const char *vsCode = vsSrc.c_str();
@@ -70,7 +72,7 @@ public:
         glGetShaderiv(vs, GL_COMPILE_STATUS, &cFlag);
         if (!cFlag) {
             glGetShaderInfoLog(vs, 512, NULL, cLog);
-            std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << cLog << std::endl;
+            LOG_ERROR("SHADER::VERTEX::COMPILATION_FAILED\n%s\n", cLog);
         }
         
         // Fragment shader
@@ -81,7 +83,7 @@ public:
         glGetShaderiv(fs, GL_COMPILE_STATUS, &cFlag);
         if (!cFlag) {
             glGetShaderInfoLog(fs, 512, NULL, cLog);
-            std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << cLog << std::endl;
+            LOG_ERROR("SHADER::FRAGMENT::COMPILATION_FAILED\n%s\n", cLog);
         }
         
         // Shader program
@@ -93,7 +95,7 @@ public:
         glGetProgramiv(ID, GL_LINK_STATUS, &cFlag);
         if (!cFlag) {
             glGetProgramInfoLog(ID, 512, NULL, cLog);
-            std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << cLog << std::endl;
+            LOG_ERROR("SHADER::PROGRAM::LINKING_FAILED\n%s\n", cLog);
         }
         
         // Clean linked shaders (What we actually need is the shader program)
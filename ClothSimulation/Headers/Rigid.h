@@ -5,6 +5,8 @@
 #include <cmath>
 #include <vector>
 
+#include "Arena.h"
+#include "Log.h"
 #include "Points.h"
 
 struct Ground
@@ -14,10 +16,11 @@ struct Ground
     glm::vec4 color;
     const double friction = 0.9;
     
+    Arena arena; // Owns the vertexes
     std::vector<Vertex*> vertexes;
     std::vector<Vertex*> faces;
     
-    Ground(Vec3 pos, Vec2 size, glm::vec4 c) {
+    Ground(const Vec3& pos, const Vec2& size, glm::vec4 c) {
         position = pos;
         width = size.x;
         height = size.y;
@@ -27,23 +30,21 @@ struct Ground
     }
     ~Ground()
     {
-        for (int i = 0; i < vertexes.size(); i++) { delete vertexes[i]; }
         vertexes.clear();
         faces.clear();
     }
     
     void init()
     {
-        vertexes.push_back(new Vertex(Vec3(0.0, 0.0, 0.0)));
-        vertexes.push_back(new Vertex(Vec3(width, 0.0, 0.0)));
-        vertexes.push_back(new Vertex(Vec3(0.0, 0.0, -height)));
-        vertexes.push_back(new Vertex(Vec3(width, 0.0, -height)));
+        vertexes.push_back(arena.create<Vertex>(Vec3(0.0, 0.0, 0.0)));
+        vertexes.push_back(arena.create<Vertex>(Vec3(width, 0.0, 0.0)));
+        vertexes.push_back(arena.create<Vertex>(Vec3(0.0, 0.0, -height)));
+        vertexes.push_back(arena.create<Vertex>(Vec3(width, 0.0, -height)));
         
         for (int i = 0; i < vertexes.size(); i ++) {
             vertexes[i]->normal = Vec3(0.0, 1.0, 0.0); // It's not neccessery to normalize here
             
-            // Debug info
-            printf("Ground[%d]: (%f, %f, %f) - (%f, %f, %f)\n", i, vertexes[i]->position.x, vertexes[i]->position.y, vertexes[i]->position.z, vertexes[i]->normal.x, vertexes[i]->normal.y, vertexes[i]->normal.z);
+            LOG_DEBUG("Ground[%d]: (%f, %f, %f) - (%f, %f, %f)\n", i, vertexes[i]->position.x, vertexes[i]->position.y, vertexes[i]->position.z, vertexes[i]->normal.x, vertexes[i]->normal.y, vertexes[i]->normal.z);
         }
         
         faces.push_back(vertexes[0]);
@@ -63,6 +64,7 @@ public:
     
     int radius;
     
+    Arena arena; // Owns the vertexes
     std::vector<Vertex*> vertexes;
     std::vector<Vertex*> faces;
     
@@ -73,7 +75,6 @@ public:
     }
     ~Sphere()
     {
-        for (int i = 0; i < vertexes.size(); i++) { delete vertexes[i]; }
         vertexes.clear();
         faces.clear();
     }
@@ -82,7 +83,7 @@ public:
     Vertex* getVertex(int x, int y)
     {
         if (x < 0 || x >= parallelNum || y < 0 || y >= meridianNum) {
-            printf("Vertex Index Out of Range.\n");
+            LOG_ERROR("Vertex Index Out of Range.\n");
             exit(-1);
         } else {
             return vertexes[1+x*meridianNum+y];
@@ -90,7 +91,7 @@ public:
     }
     Vertex* getBottom() { return vertexes[vertexes.size()-1]; }
     
-    Vec3 computeFaceNormal(Vertex* v1, Vertex* v2, Vertex* v3)
+    Vec3 computeFaceNormal(const Vertex* v1, const Vertex* v2, const Vertex* v3) const
     {
         return Vec3::cross(v2->position - v1->position, v3->position - v1->position);
     }
@@ -126,8 +127,13 @@ public:
         double radianInterval = 2.0*M_PI/meridianNum;
         
         
+        int vertexCount = parallelNum*meridianNum + 2;
+        arena.reserve(vertexCount * sizeof(Vertex));
+        vertexes.reserve(vertexCount);
+        faces.reserve(parallelNum*meridianNum*6);
+        
         Vec3 pos(0.0, radius, 0.0);
-        vertexes.push_back(new Vertex(pos)); // Top vertex
+        vertexes.push_back(arena.create<Vertex>(pos)); // Top vertex
         
         for (int i = 0; i < parallelNum; i ++) {
             pos.y -= cycleInterval;
@@ -137,11 +143,11 @@ public:
                 
                 pos.x = xzLen * sin(xRadian);
                 pos.z = xzLen * cos(xRadian);
-                vertexes.push_back(new Vertex(pos));
+                vertexes.push_back(arena.create<Vertex>(pos));
             }
         }
         pos = Vec3(0.0, -radius, 0.0);
-        vertexes.push_back(new Vertex(pos)); // Bottom vertex
+        vertexes.push_back(arena.create<Vertex>(pos)); // Bottom vertex
         
         /** Slice faces **/
         // Top cycle
@@ -183,7 +189,7 @@ struct Ball
     
     Sphere* sphere;
     
-    Ball(Vec3 cen, int r, glm::vec4 c)
+    Ball(const Vec3& cen, int r, glm::vec4 c)
     {
         center = cen;
         radius = r;
@@ -191,5 +197,7 @@ struct Ball
         
         sphere = new Sphere(radius);
     }
-    ~Ball() {}
+    ~Ball() { delete sphere; }
+    Ball(const Ball&) = delete; // Owns its sphere
+    Ball& operator=(const Ball&) = delete;
 };
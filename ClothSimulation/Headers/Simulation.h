@@ -0,0 +1,201 @@
+#pragma once
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "Cloth.h"
+#include "Commands.h"
+#include "Rigid.h"
+#include "Trace.h"
+
+/** Switches shared by simulations of any scalar type **/
+struct SimulationOptions
+{
+    /** Adaptive stepping: a frame keeps its length but is cut into as few substeps as stability allows **/
+    bool adaptive = false;
+    int minSubsteps = 4;
+    int maxSubsteps = 100;
+    double safety = 0.9;        // Fraction of the estimated stable step actually taken
+    double courant = 0.5;       // A node may move at most this fraction of the shortest rest length per substep
+    
+    bool sleeping = false;      // Let resting tiles of the cloth fall asleep, see Cloth::updateSleep
+    bool blocked = false;       // Run each substep block by block, see Cloth::blockedSubstep
+    
+    /** Aerodynamics: drag and lift per face against the wind field, see Cloth::applyAerodynamics **/
+    bool aerodynamics = false;  // Otherwise the wind is a uniform push on every node
+    double airDensity = 1.2;    // kg/m^3
+    double dragCoef = 1.0;
+    double liftCoef = 0.5;
+    int aeroInterval = 5;       // Substeps between updates of the aerodynamic forces, they are held in between
+};
+
+/** One cloth stepped against the scene's rigid bodies, shared by the window, benchmarks and accuracy harness **/
+template <typename T>
+struct SimulationT : SimulationOptions
+{
+    typedef Vec3T<T> Vec3;
+    typedef NodeT<T> Node;
+    typedef SpringT<T> Spring;
+    typedef ClothT<T> Cloth;
+    
+    Cloth* cloth;
+    Ground* ground;
+    Ball* ball;
+    
+    Vec3 gravity;
+    double timeStep;     // Fixed substep, a frame always advances iterationFreq * timeStep
+    
+    int substeps;               // Substeps used by the last frame
+    double stableStep;          // Largest step the springs allow, from stiffness and damping over mass
+    double minRestLen;
+    
+    /** Input, pushed from any thread and drained by the simulation **/
+    CommandQueue<SimCommand, 1024> commands;
+    Vec3T<double> wind;         // Mean wind velocity with aerodynamics, else a push on every node once per frame
+    WindField windField;        // Turbulence around the mean wind
+    double time = 0.0;          // Simulated seconds
+    int aeroAge = 0;            // Substeps since the aerodynamic forces were updated
+    bool paused = false;
+    
+    SimulationT(Cloth* c, Ground* g, Ball* b, double step)
+    {
+        cloth = c;
+        ground = g;
+        ball = b;
+        timeStep = step;
+        gravity = Vec3(0.0, -9.8 / cloth->iterationFreq, 0.0);
+        substeps = cloth->iterationFreq;
+        estimateStability();
+    }
+    
+    /** Gershgorin bound of the mass-spring system: omega^2 <= max over nodes of 2 * sum(k) / m **/
+    // Symplectic Euler stays stable while dt < 2 / omega, and the damping term while dt < 2 * m / (2 * sum(c)).
+    // Only depends on the topology, so it is computed once and again whenever springs change.
+    void estimateStability()
+    {
+        typename Cloth::NodeIndex index = cloth->nodeIndices();
+        std::vector<double> stiffness(cloth->nodes.size(), 0.0), damping(cloth->nodes.size(), 0.0);
+        minRestLen = INFINITY;
+        for (int i = 0; i < cloth->springs.size(); i ++) {
+            Spring* s = cloth->springs[i];
+            if (s->isTorn) continue;
+            int a = index[s->node1], b = index[s->node2];
+            stiffness[a] += s->hookCoef;
+            stiffness[b] += s->hookCoef;
+            damping[a] += s->dampCoef;
+            damping[b] += s->dampCoef;
+            minRestLen = std::min(minRestLen, (double)s->restLen);
+        }
+        if (cloth->bendingModel == Cloth::BENDING_ISOMETRIC) { // Row sums of its matrix stand for 2 * sum(k)
+            const IsometricBendingT<T>& bending = cloth->isometric;
+            for (int i = 0; i < cloth->nodes.size(); i ++) {
+                double row = bending.rowSum(i) / 2.0;
+                stiffness[i] += row;
+                damping[i] += row * bending.damping / bending.stiffness;
+            }
+        }
+        if (cloth->stretchModel != Cloth::STRETCH_SPRINGS) {
+            cloth->membrane.addStability(cloth->nodes, stiffness, damping);
+            minRestLen = std::min(minRestLen, cloth->membrane.minEdge);
+        }
+        stableStep = INFINITY;
+        for (int i = 0; i < cloth->nodes.size(); i ++) {
+            double mass = cloth->nodes[i]->mass;
+            if (stiffness[i] > 0.0) stableStep = std::min(stableStep, 2.0 / sqrt(2.0 * stiffness[i] / mass));
+            if (damping[i] > 0.0) stableStep = std::min(stableStep, mass / damping[i]);
+        }
+    }
+
+    /** Substeps for the coming frame: bounded by the spring stability and a CFL-like velocity limit **/
+    int chooseSubsteps()
+    {
+        double frameTime = cloth->iterationFreq * timeStep;
+        double maxSpeed = 0.0;
+        for (int i = 0; i < cloth->nodes.size(); i ++) {
+            Node* n = cloth->nodes[i];
+            if (!n->isFixed) maxSpeed = std::max(maxSpeed, (double)Vec3::dot(n->velocity, n->velocity));
+        }
+        maxSpeed = sqrt(maxSpeed);
+
+        double step = safety * stableStep;
+        if (maxSpeed > 0.0) step = std::min(step, courant * minRestLen / maxSpeed);
+        int wanted = (int)ceil(frameTime / step);
+        wanted = std::max(minSubsteps, std::min(maxSubsteps, wanted));
+        // Grow at once when motion picks up, shrink one substep per frame so it does not oscillate
+        return wanted >= substeps ? wanted : substeps - 1;
+    }
+
+    void substep()
+    {
+        substep(timeStep);
+    }
+
+    /** Apply the queued commands, coalesced so the nodes are walked once however many impulses came in **/
+    void applyCommands(double dt)
+    {
+        Vec3T<double> impulse;
+        bool pushed = false;
+        SimCommand c;
+        while (commands.pop(c)) {
+            switch (c.type) {
+                case SimCommand::FORCE_IMPULSE: impulse += c.vec; pushed = true; break;
+                case SimCommand::SET_WIND: wind = c.vec; break;
+                case SimCommand::PIN: cloth->pin(c.index, Vec3()); break;
+                case SimCommand::UNPIN: cloth->unPin(c.index); break;
+                case SimCommand::PAUSE: paused = true; break;
+                case SimCommand::RESUME: paused = false; break;
+                case SimCommand::SET_TEARING: cloth->tearStretch = c.vec.x; break;
+            }
+        }
+        if (pushed) cloth->addForce(Vec3(impulse * (timeStep / dt))); // Acts for one substep, keep the impulse of a fixed step
+    }
+    
+    void substep(double dt)
+    {
+        applyCommands(dt);
+        if (aerodynamics) {
+            TRACE_ZONE("aerodynamics");
+            // Drag and lift change over the relaxation time of the cloth in the air, far slower than a substep
+            if (aeroAge == 0) cloth->updateAerodynamics(airDensity, dragCoef, liftCoef);
+            aeroAge = (aeroAge + 1) % std::max(1, aeroInterval);
+        }
+        if (blocked) {
+            TRACE_ZONE("blockedSubstep");
+            cloth->blockedSubstep(dt, gravity, ground, ball, aerodynamics);
+        } else {
+            { TRACE_ZONE("computeForce"); cloth->computeForce(dt, gravity, aerodynamics); }
+            { TRACE_ZONE("integrate"); cloth->integrate(dt); }
+            { TRACE_ZONE("collisionResponse"); cloth->collisionResponse(ground, ball); }
+        }
+        if (!cloth->pendingTears.empty() || !cloth->membrane.tornFaces.empty()) { TRACE_ZONE("applyTears"); cloth->applyTears(); }
+        if (sleeping) { TRACE_ZONE("updateSleep"); cloth->updateSleep(ball); }
+        else if (cloth->sleepingTiles > 0) cloth->wakeAll();
+    }
+
+    void frame() // Everything that happens between two rendered frames
+    {
+        TRACE_ZONE("simulate");
+        applyCommands(timeStep); // Scaled with the forces already pending below
+        if (paused) return;
+        if (aerodynamics) { TRACE_ZONE("sampleWind"); cloth->sampleWind(windField, wind, time); }
+        else if (wind != Vec3T<double>()) cloth->addForce(Vec3(wind));
+        if (adaptive && cloth->stretchModel == Cloth::STRETCH_STVK) estimateStability(); // Its stiffness grows with the stretch
+        substeps = adaptive ? chooseSubsteps() : cloth->iterationFreq;
+        double dt = adaptive ? cloth->iterationFreq * timeStep / substeps : timeStep;
+        TRACE_COUNTER("substeps", substeps);
+        TRACE_COUNTER("sleepingTiles", cloth->sleepingTiles);
+        if (dt != timeStep) { // Forces added since the last frame act for one substep, keep their impulse the same
+            double scale = timeStep / dt;
+            for (int i = 0; i < cloth->nodes.size(); i ++) { cloth->nodes[i]->force = cloth->nodes[i]->force * scale; }
+        }
+        for (int i = 0; i < substeps; i ++) {
+            substep(dt);
+        }
+        time += cloth->iterationFreq * timeStep;
+        TRACE_ZONE("computeNormal");
+        cloth->computeNormal();
+    }
+};
+
+typedef SimulationT<Scalar> Simulation;
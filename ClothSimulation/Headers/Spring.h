@@ -4,16 +4,21 @@
 
 using namespace std;
 
-class Spring
+template <typename T>
+class SpringT
 {
 public:
+    typedef Vec3T<T> Vec3;
+    typedef NodeT<T> Node;
+    
     Node *node1;
     Node *node2;
-	double restLen;
-    double hookCoef;
-    double dampCoef;
+	T restLen;
+    T hookCoef;
+    T dampCoef;
+    bool isTorn = false; // Broken by ClothT::tearSpring, its slot waits for reuse
     
-	Spring(Node *n1, Node *n2, double k)
+	SpringT(Node *n1, Node *n2, T k)
 	{
         node1 = n1;
         node2 = n2;
@@ -24,13 +29,30 @@ public:
         dampCoef = 5.0;
 	}
 
-	void applyInternalForce(double timeStep) // Compute spring internal force
+    bool isAsleep() { return node1->isAsleep && node2->isAsleep; }
+    bool isActive() { return !isTorn && !isAsleep(); }
+    
+	T applyInternalForce(T timeStep) // Compute spring internal force, returns the current length
 	{
-        double currLen = Vec3::dist(node1->position, node2->position);
-        Vec3 fDir1 = (node2->position - node1->position)/currLen;
-        Vec3 diffV1 = node2->velocity - node1->velocity;
-        Vec3 f1 = fDir1 * ((currLen-restLen)*hookCoef + Vec3::dot(diffV1, fDir1)*dampCoef);
-        node1->addForce(f1);
-        node2->addForce(f1.minus());
+        Vec3 fDir1;
+        T currLen;
+        T f1 = tension(node1->position, node1->velocity, node2->position, node2->velocity, fDir1, currLen);
+        if (f1 == 0) return currLen;
+        node1->force.axpy(f1, fDir1);
+        node2->force.axpy(-f1, fDir1);
+        return currLen;
 	}
+    
+    /** Force on node1 along dir for the given end states, node2 gets the opposite **/
+    // Also used with halo copies of the ends, see ClothT::blockedSubstep
+    T tension(const Vec3& p1, const Vec3& v1, const Vec3& p2, const Vec3& v2, Vec3& dir, T& currLen) const
+    {
+        Vec3 span = p2 - p1;
+        currLen = span.length();
+        if (currLen < 1e-9) return 0; // Collision can project both ends onto the same point, no direction then
+        dir = span/currLen;
+        return (currLen-restLen)*hookCoef + Vec3::dot(v2 - v1, dir)*dampCoef;
+    }
 };
+
+typedef SpringT<Scalar> Spring;
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Log.h"
+
+/** Everything the derived topology of a cloth depends on **/
+struct TopologyKey
+{
+    char magic[8];
+    unsigned version;
+    unsigned scalarSize;
+    int nodesPerRow, nodesPerCol, nodesDensity;
+    int order;
+    int blockSize;
+
+    TopologyKey(unsigned scalar, int rows, int cols, int density, int nodeOrder, int block)
+    {
+        memset(this, 0, sizeof(*this)); // Padding too, the key is hashed and compared bytewise
+        memcpy(magic, "CLOTHTOP", 8);
+        version = 1;
+        scalarSize = scalar;
+        nodesPerRow = rows;
+        nodesPerCol = cols;
+        nodesDensity = density;
+        order = nodeOrder;
+        blockSize = block;
+    }
+
+    unsigned long long hash() const // FNV-1a
+    {
+        unsigned long long h = 14695981039346656037ULL;
+        const unsigned char* bytes = (const unsigned char*)this;
+        for (int i = 0; i < sizeof(*this); i ++) { h = (h ^ bytes[i]) * 1099511628211ULL; }
+        return h;
+    }
+};
+
+/** Sections of int arrays, each a 64 bit count and the values **/
+struct TopologyWriter
+{
+    FILE* out;
+
+    void section(const int* data, long long count)
+    {
+        fwrite(&count, sizeof(count), 1, out);
+        if (count > 0) fwrite(data, sizeof(int), count, out);
+    }
+    void section(const std::vector<int>& v) { section(v.empty() ? NULL : &v[0], (long long)v.size()); }
+};
+
+/** Reads the sections back from the mapping, any count that does not fit fails the whole entry **/
+struct TopologyReader
+{
+    const char* cursor;
+    const char* end;
+    bool ok;
+
+    /** Values of the next section, expected is its count or -1 for any **/
+    const int* next(long long expected, long long* count = NULL)
+    {
+        long long n;
+        if (!ok || end - cursor < (long long)sizeof(n)) return fail();
+        memcpy(&n, cursor, sizeof(n));
+        cursor += sizeof(n);
+        if (n < 0 || (expected >= 0 && n != expected) || (end - cursor) / (long long)sizeof(int) < n) return fail();
+        const int* data = (const int*)cursor;
+        cursor += n * sizeof(int);
+        if (count) *count = n;
+        return data;
+    }
+    void into(std::vector<int>& v, long long expected = -1)
+    {
+        long long n = 0;
+        const int* data = next(expected, &n);
+        if (data) v.assign(data, data + n);
+    }
+    const int* fail()
+    {
+        ok = false;
+        return NULL;
+    }
+
+    /** Checks of what was read, an entry is only applied once all of them passed **/
+    static bool inRange(const std::vector<int>& v, int lo, int hi) { return v.empty() || inRange(&v[0], (long long)v.size(), lo, hi); }
+    static bool inRange(const int* data, long long count, int lo, int hi) // Every value in [lo, hi)
+    {
+        for (long long i = 0; i < count; i ++) {
+            if (data[i] < lo || data[i] >= hi) return false;
+        }
+        return true;
+    }
+    static bool permutation(const int* data, int count) // Every value in [0, count) once
+    {
+        std::vector<char> seen(count, 0);
+        for (int i = 0; i < count; i ++) {
+            if (data[i] < 0 || data[i] >= count || seen[data[i]]) return false;
+            seen[data[i]] = 1;
+        }
+        return true;
+    }
+    static bool offsets(const std::vector<int>& start, int total) // Ascending from 0 to total
+    {
+        if (start.empty() || start[0] != 0 || start.back() != total) return false;
+        for (int i = 0; i + 1 < start.size(); i ++) {
+            if (start[i] > start[i+1]) return false;
+        }
+        return true;
+    }
+};
+
+/** On-disk cache of the derived topology of cloths **/
+// An entry holds what a cloth derives from its grid alone, for one TopologyKey, and is named by the key's hash.
+// On a hit the entry is mapped read-only with mmap and copied into the cloth, instead of coloring, blocking and
+// sorting it again. The directory comes from the CLOTH_TOPOLOGY_CACHE environment variable, nothing is cached
+// without it. Entries are written to a temporary file and renamed into place, so concurrent jobs starting at the
+// same resolution never read a partial entry, at worst both write it.
+struct TopologyCache
+{
+    std::string directory;
+    int hits = 0;
+    int misses = 0;
+
+    TopologyCache()
+    {
+        const char* dir = getenv("CLOTH_TOPOLOGY_CACHE");
+        if (dir) directory = dir;
+    }
+
+    bool enabled() const { return !directory.empty(); }
+
+    std::string path(const TopologyKey& key) const
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "/topology-%016llx.bin", key.hash());
+        return directory + name;
+    }
+
+    /** Calls read on the entry of key, false on a miss or when read rejects it or leaves sections unread **/
+    bool load(const TopologyKey& key, const std::function<bool(TopologyReader&)>& read)
+    {
+        if (!enabled()) return false;
+        std::string file = path(key);
+        int fd = open(file.c_str(), O_RDONLY);
+        if (fd < 0) {
+            misses ++;
+            return false;
+        }
+        struct stat st;
+        void* map = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(key)) {
+            map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (map == MAP_FAILED) {
+            misses ++;
+            return false;
+        }
+        TopologyReader reader = { (const char*)map + sizeof(key), (const char*)map + st.st_size, true };
+        bool ok = memcmp(map, &key, sizeof(key)) == 0 && read(reader) && reader.ok && reader.cursor == reader.end;
+        munmap(map, st.st_size);
+        if (!ok) {
+            LOG_WARN("Topology cache entry %s does not match, rebuilding it\n", file.c_str());
+            misses ++;
+            return false;
+        }
+        LOG_DEBUG("Topology cache hit %s\n", file.c_str());
+        hits ++;
+        return true;
+    }
+
+    void save(const TopologyKey& key, const std::function<void(TopologyWriter&)>& write)
+    {
+        if (!enabled()) return;
+        mkdir(directory.c_str(), 0755);
+        std::string file = path(key);
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".%d.tmp", (int)getpid());
+        std::string temp = file + suffix;
+        TopologyWriter writer = { fopen(temp.c_str(), "wb") };
+        if (!writer.out) {
+            LOG_WARN("Cannot write topology cache entry %s\n", temp.c_str());
+            return;
+        }
+        fwrite(&key, sizeof(key), 1, writer.out);
+        write(writer);
+        bool ok = !ferror(writer.out);
+        ok = fclose(writer.out) == 0 && ok;
+        if (!ok || rename(temp.c_str(), file.c_str()) != 0) {
+            LOG_WARN("Cannot write topology cache entry %s\n", file.c_str());
+            remove(temp.c_str());
+        }
+    }
+};
+TopologyCache topologyCache;
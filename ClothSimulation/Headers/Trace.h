@@ -0,0 +1,228 @@
+#pragma once
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/** Scoped timing zones **/
+// Build with ENABLE_TRACE=1 to record zones. Otherwise every TRACE_* macro expands to nothing,
+// so the simulation loop carries no timing code at all.
+#ifndef ENABLE_TRACE
+#define ENABLE_TRACE 0
+#endif
+
+#if ENABLE_TRACE
+
+struct TraceEvent
+{
+    const char* name;   // Must be a string literal (only the pointer is stored)
+    long long start;    // Nanoseconds since the tracer was created
+    long long duration; // Nanoseconds, unused by counters
+    double value;       // Counters only
+    bool counter;
+    bool job;           // A worker's share of a pool job, named after the zone that started the job
+};
+
+struct TraceBuffer // Ring buffer owned by one thread, only read after the threads are idle
+{
+    static const int capacity = 1 << 16;
+
+    int tid;
+    long long count; // Events ever recorded, the ring keeps the last 'capacity' of them
+    std::vector<TraceEvent> events;
+
+    TraceBuffer(int id)
+    {
+        tid = id;
+        count = 0;
+        events.resize(capacity);
+    }
+
+    void push(const char* name, long long start, long long duration, bool job)
+    {
+        TraceEvent& e = events[count % capacity];
+        e.name = name;
+        e.start = start;
+        e.duration = duration;
+        e.value = 0.0;
+        e.counter = false;
+        e.job = job;
+        count ++;
+    }
+    void pushCounter(const char* name, long long time, double value)
+    {
+        TraceEvent& e = events[count % capacity];
+        e.name = name;
+        e.start = time;
+        e.duration = 0;
+        e.value = value;
+        e.counter = true;
+        e.job = false;
+        count ++;
+    }
+
+    int size() { return count < capacity ? (int)count : capacity; }
+};
+
+struct Tracer
+{
+    std::chrono::steady_clock::time_point origin;
+    std::mutex lock; // Only guards the buffer list, never taken while recording
+    std::vector<TraceBuffer*> buffers;
+
+    Tracer() { origin = std::chrono::steady_clock::now(); }
+    ~Tracer()
+    {
+        for (int i = 0; i < buffers.size(); i ++) { delete buffers[i]; }
+        buffers.clear();
+    }
+
+    long long now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    TraceBuffer* local() // Buffer of the calling thread, registered on first use
+    {
+        thread_local TraceBuffer* buffer = NULL;
+        if (buffer == NULL) {
+            std::lock_guard<std::mutex> guard(lock);
+            buffer = new TraceBuffer((int)buffers.size());
+            buffers.push_back(buffer);
+        }
+        return buffer;
+    }
+
+    /** Chrome trace_event JSON, open with chrome://tracing or Perfetto **/
+    bool exportChrome(const char* path)
+    {
+        FILE* file = fopen(path, "w");
+        if (file == NULL) {
+            printf("Tracer: Failed to open %s\n", path);
+            return false;
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        bool first = true;
+        for (int b = 0; b < buffers.size(); b ++) {
+            TraceBuffer* buffer = buffers[b];
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+                    first ? "" : ",\n", buffer->tid, buffer->tid == 0 ? "Main" : "Worker", buffer->tid);
+            first = false;
+            for (int i = 0; i < buffer->size(); i ++) {
+                TraceEvent& e = buffer->events[i];
+                if (e.counter) {
+                    fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"args\":{\"value\":%g}}",
+                            e.name, buffer->tid, e.start/1000.0, e.value);
+                    continue;
+                }
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                        e.name, buffer->tid, e.start/1000.0, e.duration/1000.0);
+            }
+        }
+        fprintf(file, "\n]}\n");
+        fclose(file);
+        printf("Tracer: Wrote %s\n", path);
+        return true;
+    }
+
+    /** Per-zone mean, p50 and p99 over every recorded event of every thread **/
+    void printSummary()
+    {
+        std::map<std::string, std::vector<long long> > zones;
+        std::map<std::string, std::vector<double> > counters;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            for (int b = 0; b < buffers.size(); b ++) {
+                for (int i = 0; i < buffers[b]->size(); i ++) {
+                    TraceEvent& e = buffers[b]->events[i];
+                    if (e.counter) counters[e.name].push_back(e.value);
+                    else if (e.job) zones[std::string(e.name) + " (workers)"].push_back(e.duration); // Apart from the caller's own zone
+                    else zones[e.name].push_back(e.duration);
+                }
+            }
+        }
+
+        printf("%-24s %10s %12s %12s %12s %14s\n", "Zone", "Count", "Mean(us)", "P50(us)", "P99(us)", "Total(ms)");
+        for (std::map<std::string, std::vector<long long> >::iterator it = zones.begin(); it != zones.end(); ++it) {
+            std::vector<long long>& d = it->second;
+            std::sort(d.begin(), d.end());
+            double total = 0.0;
+            for (int i = 0; i < d.size(); i ++) { total += d[i]; }
+            printf("%-24s %10d %12.3f %12.3f %12.3f %14.3f\n", it->first.c_str(), (int)d.size(),
+                   total/d.size()/1000.0, percentile(d, 0.50)/1000.0, percentile(d, 0.99)/1000.0, total/1000000.0);
+        }
+        
+        if (counters.empty()) return;
+        printf("%-24s %10s %12s %12s %12s\n", "Counter", "Count", "Mean", "P50", "P99");
+        for (std::map<std::string, std::vector<double> >::iterator it = counters.begin(); it != counters.end(); ++it) {
+            std::vector<double>& v = it->second;
+            std::sort(v.begin(), v.end());
+            double total = 0.0;
+            for (int i = 0; i < v.size(); i ++) { total += v[i]; }
+            printf("%-24s %10d %12.3f %12.3f %12.3f\n", it->first.c_str(), (int)v.size(),
+                   total/v.size(), percentile(v, 0.50), percentile(v, 0.99));
+        }
+    }
+
+    template <typename T>
+    static double percentile(const std::vector<T>& sorted, double p) // Nearest rank
+    {
+        if (sorted.empty()) return 0.0;
+        int rank = (int)ceil(p * sorted.size()) - 1;
+        return (double)sorted[std::max(0, std::min(rank, (int)sorted.size()-1))];
+    }
+};
+Tracer tracer;
+
+struct TraceZone // Records the lifetime of this object into the thread's ring buffer
+{
+    const char* name;
+    const char* parent;
+    long long start;
+    bool job;
+
+    TraceZone(const char* n, bool j = false)
+    {
+        name = n;
+        parent = current();
+        current() = n;
+        job = j;
+        start = tracer.now();
+    }
+    ~TraceZone()
+    {
+        long long end = tracer.now();
+        tracer.local()->push(name, start, end - start, job);
+        current() = parent;
+    }
+
+    static const char*& current() // Innermost open zone of the calling thread, NULL outside any
+    {
+        thread_local const char* zone = NULL;
+        return zone;
+    }
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+#define TRACE_JOB_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name, true)
+#define TRACE_CURRENT() TraceZone::current()
+#define TRACE_EXPORT(path) tracer.exportChrome(path)
+#define TRACE_COUNTER(name, value) tracer.local()->pushCounter(name, tracer.now(), value)
+#define TRACE_SUMMARY() tracer.printSummary()
+#else
+#define TRACE_ZONE(name)
+#define TRACE_JOB_ZONE(name)
+#define TRACE_CURRENT() NULL
+#define TRACE_COUNTER(name, value)
+#define TRACE_EXPORT(path)
+#define TRACE_SUMMARY()
+#endif
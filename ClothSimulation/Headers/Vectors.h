@@ -2,141 +2,186 @@
 
 #include <math.h>
 
-struct Vec2
+#if VEC_SIMD && defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+/** Scalar type of the simulation core (Node, Spring, Cloth), build with SIM_SCALAR=float for single precision **/
+// The scene, rigid bodies and UI keep using double Vec2 / Vec3.
+#ifndef SIM_SCALAR
+#define SIM_SCALAR double
+#endif
+typedef SIM_SCALAR Scalar;
+
+/** Fused multiply-add only where the hardware has it, the library fallback is far slower than a * b + c **/
+#if defined(__FMA__) || defined(__ARM_FEATURE_FMA)
+#define VEC_FMA(a, b, c) fma((a), (b), (c))
+#define VEC_FUSED_CONSTEXPR inline
+#else
+#define VEC_FMA(a, b, c) ((a) * (b) + (c))
+#define VEC_FUSED_CONSTEXPR constexpr
+#endif
+/** Operators with an SSE version below can not be constexpr **/
+#if VEC_SIMD && defined(__SSE__)
+#define VEC_SIMD_CONSTEXPR inline
+#else
+#define VEC_SIMD_CONSTEXPR constexpr
+#endif
+
+template <typename T>
+struct Vec2T
 {
-    double x;
-    double y;
-    
-    Vec2(void)
-    {
-        x = 0.0;
-        y = 0.0;
-    }
-    Vec2(double x0, double y0)
-    {
-        x = x0;
-        y = y0;
-    }
-    ~Vec2() {}
-    
-    Vec2 operator+(Vec2 v)
-    {
-        return Vec2(x+v.x, y+v.y);
-    }
-    Vec2 operator-(Vec2 v)
-    {
-        return Vec2(x-v.x, y-v.y);
-    }
+    T x;
+    T y;
+
+    constexpr Vec2T(void) : x(0), y(0) {}
+    constexpr Vec2T(T x0, T y0) : x(x0), y(y0) {}
+    template <typename U>
+    constexpr Vec2T(const Vec2T<U>& v) : x(v.x), y(v.y) {} // Between precisions
 
-    void operator+=(Vec2 v)
+    constexpr Vec2T operator+(const Vec2T& v) const { return Vec2T(x+v.x, y+v.y); }
+    constexpr Vec2T operator-(const Vec2T& v) const { return Vec2T(x-v.x, y-v.y); }
+
+    constexpr Vec2T& operator+=(const Vec2T& v)
     {
         x += v.x;
         y += v.y;
+        return *this;
     }
-    void operator-=(Vec2 v)
+    constexpr Vec2T& operator-=(const Vec2T& v)
     {
         x -= v.x;
         y -= v.y;
+        return *this;
     }
-    
 };
 
-struct Vec3
+/** Three components padded to four lanes, so a vector fills one SIMD register and loads stay aligned **/
+// Heap allocation before C++17 only guarantees 16 bytes, so double vectors are 32 bytes long but 16 aligned.
+template <typename T>
+struct alignas(4*sizeof(T) > 16 ? 16 : 4*sizeof(T)) Vec3T
 {
-    double x;
-    double y;
-    double z;
-    
-    Vec3(void)
-    {
-        x = 0.0;
-        y = 0.0;
-        z = 0.0;
-    }
-    Vec3(double x0, double y0, double z0)
-    {
-		x = x0;
-		y = y0;
-		z = z0;
-	}
-	~Vec3(){}
-    
-    static Vec3 cross(Vec3 v1, Vec3 v2)
+    typedef Vec3T<T> Vec3;
+
+    T x;
+    T y;
+    T z;
+    T w;    // Padding, always 0
+
+    constexpr Vec3T(void) : x(0), y(0), z(0), w(0) {}
+    constexpr Vec3T(T x0, T y0, T z0) : x(x0), y(y0), z(z0), w(0) {}
+    template <typename U>
+    constexpr Vec3T(const Vec3T<U>& v) : x(v.x), y(v.y), z(v.z), w(0) {} // Between precisions
+
+    static constexpr Vec3 cross(const Vec3& v1, const Vec3& v2)
     {
         return Vec3(v1.y*v2.z - v1.z*v2.y, v1.z*v2.x - v1.x*v2.z, v1.x*v2.y - v1.y*v2.x);
     }
-    static double dot(Vec3 v1, Vec3 v2)
-    {
-        return (v1.x*v2.x + v1.y*v2.y + v1.z*v2.z);
-    }
-    static double dist(Vec3 v1, Vec3 v2)
+    static VEC_FUSED_CONSTEXPR T dot(const Vec3& v1, const Vec3& v2)
     {
-        return sqrt(pow(v1.x - v2.x, 2) + pow(v1.y - v2.y, 2) + pow(v1.z - v2.z, 2));
+        return VEC_FMA(v1.z, v2.z, VEC_FMA(v1.y, v2.y, v1.x*v2.x));
     }
-    
-    Vec3 minus()
+    static T dist(const Vec3& v1, const Vec3& v2)
     {
-        return Vec3(-x, -y, -z);
+        return (v1 - v2).length();
     }
-    
-	Vec3 operator+(Vec3 v)
-	{
-		return Vec3(x+v.x, y+v.y, z+v.z);
-	}
-	Vec3 operator-(Vec3 v)
-	{
-		return Vec3(x-v.x, y-v.y, z-v.z);
-	}
 
-	void operator+=(Vec3 v)
+    constexpr Vec3 minus() const { return Vec3(-x, -y, -z); }
+    constexpr Vec3 operator-() const { return Vec3(-x, -y, -z); }
+
+	VEC_SIMD_CONSTEXPR Vec3 operator+(const Vec3& v) const { return Vec3(x+v.x, y+v.y, z+v.z); }
+	VEC_SIMD_CONSTEXPR Vec3 operator-(const Vec3& v) const { return Vec3(x-v.x, y-v.y, z-v.z); }
+	VEC_SIMD_CONSTEXPR Vec3 operator*(T n) const { return Vec3(x*n, y*n, z*n); }
+	constexpr Vec3 operator/(T n) const { return Vec3(x/n, y/n, z/n); }
+
+	constexpr Vec3& operator+=(const Vec3& v)
 	{
 		x += v.x;
 		y += v.y;
 		z += v.z;
+        return *this;
 	}
-	void operator-=(Vec3 v)
+	constexpr Vec3& operator-=(const Vec3& v)
 	{
 		x -= v.x;
 		y -= v.y;
 		z -= v.z;
+        return *this;
 	}
-    
-	Vec3 operator*(double n)
-	{
-		return Vec3(x*n, y*n, z*n);
-	}
-	Vec3 operator/(double n)
-	{
-		return Vec3(x/n, y/n, z/n);
-	}
-    
-    bool operator ==(Vec3 &v)
-    {
-        return x == v.x && y == v.y&&z == v.z;
-    }
-    bool operator!=(Vec3 &v)
+    constexpr Vec3& operator*=(T n)
     {
-        return x != v.x || y != v.y || z != v.z;
+        x *= n;
+        y *= n;
+        z *= n;
+        return *this;
     }
 
-    double length()
+    /** this += a * v, the update every integrator and force accumulator does **/
+    inline Vec3& axpy(T a, const Vec3& v)
     {
-        return sqrt(x*x + y*y + z*z);
+        x = VEC_FMA(a, v.x, x);
+        y = VEC_FMA(a, v.y, y);
+        z = VEC_FMA(a, v.z, z);
+        return *this;
     }
-    
+
+    constexpr bool operator==(const Vec3& v) const { return x == v.x && y == v.y && z == v.z; }
+    constexpr bool operator!=(const Vec3& v) const { return x != v.x || y != v.y || z != v.z; }
+
+    VEC_FUSED_CONSTEXPR T lengthSquared() const { return dot(*this, *this); }
+    T length() const { return sqrt(lengthSquared()); }
+
     void normalize()
     {
-        double w = length();
-        if (w < 0.00001) return;
-        
-        x /= w;
-        y /= w;
-        z /= w;
+        T len = length();
+        if (len < 0.00001) return;
+
+        x /= len;
+        y /= len;
+        z /= len;
     }
-	
-	void setZeroVec(){
-        x = 0.0;
-        y = 0.0;
-        z = 0.0;
+
+	constexpr void setZeroVec()
+    {
+        x = 0;
+        y = 0;
+        z = 0;
 	}
 };
+
+template <typename T>
+VEC_SIMD_CONSTEXPR Vec3T<T> operator*(T n, const Vec3T<T>& v) { return v * n; }
+
+#if VEC_SIMD && defined(__SSE__)
+/** Optional SSE backing for single precision, the padded lane makes every operand one aligned load **/
+template <>
+inline Vec3T<float> Vec3T<float>::operator+(const Vec3T<float>& v) const
+{
+    Vec3T<float> r;
+    _mm_store_ps(&r.x, _mm_add_ps(_mm_load_ps(&x), _mm_load_ps(&v.x)));
+    return r;
+}
+template <>
+inline Vec3T<float> Vec3T<float>::operator-(const Vec3T<float>& v) const
+{
+    Vec3T<float> r;
+    _mm_store_ps(&r.x, _mm_sub_ps(_mm_load_ps(&x), _mm_load_ps(&v.x)));
+    return r;
+}
+template <>
+inline Vec3T<float> Vec3T<float>::operator*(float n) const
+{
+    Vec3T<float> r;
+    _mm_store_ps(&r.x, _mm_mul_ps(_mm_load_ps(&x), _mm_set1_ps(n))); // w stays 0 * n
+    return r;
+}
+template <>
+inline Vec3T<float>& Vec3T<float>::axpy(float a, const Vec3T<float>& v)
+{
+    _mm_store_ps(&x, _mm_add_ps(_mm_load_ps(&x), _mm_mul_ps(_mm_set1_ps(a), _mm_load_ps(&v.x))));
+    return *this;
+}
+#endif
+
+typedef Vec2T<double> Vec2;
+typedef Vec3T<double> Vec3;
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <math.h>
+
+#include "Vectors.h"
+
+/** Spatially varying wind: a mean flow plus procedural turbulence **/
+// The turbulence is 3D value noise carried along by the mean flow (frozen turbulence) that also changes
+// slowly in place, so gusts sweep over the cloth instead of pulsing everywhere at once.
+struct WindField
+{
+    double gust = 0.0;      // Turbulence amplitude, m/s, 0 gives a uniform wind
+    double scale = 2.0;     // Size of a gust, m
+    double period = 4.0;    // Seconds for the turbulence to change in place
+    unsigned seed = 1;
+
+    /** Lattice value in [-1, 1] **/
+    static double lattice(int x, int y, int z, unsigned seed)
+    {
+        unsigned h = seed * 0x9E3779B9u;
+        h ^= (unsigned)x * 0x85EBCA6Bu;
+        h = (h ^ (h >> 13)) * 0xC2B2AE35u;
+        h ^= (unsigned)y * 0x27D4EB2Fu;
+        h = (h ^ (h >> 15)) * 0x165667B1u;
+        h ^= (unsigned)z * 0x9E3779B1u;
+        h = (h ^ (h >> 16)) * 0x85EBCA6Bu;
+        h ^= h >> 13;
+        return (h & 0xFFFFFF) / (double)0x7FFFFF - 1.0;
+    }
+
+    /** Smoothly interpolated lattice values, in [-1, 1] **/
+    static double noise(double x, double y, double z, unsigned seed)
+    {
+        double fx = floor(x), fy = floor(y), fz = floor(z);
+        int ix = (int)fx, iy = (int)fy, iz = (int)fz;
+        double tx = x - fx, ty = y - fy, tz = z - fz;
+        tx = tx * tx * (3.0 - 2.0 * tx);
+        ty = ty * ty * (3.0 - 2.0 * ty);
+        tz = tz * tz * (3.0 - 2.0 * tz);
+
+        double c[2][2];
+        for (int dz = 0; dz < 2; dz ++) {
+            for (int dy = 0; dy < 2; dy ++) {
+                double a = lattice(ix, iy+dy, iz+dz, seed);
+                double b = lattice(ix+1, iy+dy, iz+dz, seed);
+                c[dz][dy] = a + (b - a) * tx;
+            }
+        }
+        double y0 = c[0][0] + (c[0][1] - c[0][0]) * ty;
+        double y1 = c[1][0] + (c[1][1] - c[1][0]) * ty;
+        return y0 + (y1 - y0) * tz;
+    }
+
+    /** Wind velocity at world position p **/
+    Vec3 sample(const Vec3& mean, const Vec3& p, double time) const
+    {
+        if (gust == 0.0) return mean;
+        Vec3 q = (p - mean * time) / scale;
+        double w = time / period;
+        return mean + Vec3(noise(q.x + w, q.y, q.z, seed),
+                           noise(q.x, q.y + w, q.z, seed + 1),
+                           noise(q.x, q.y, q.z + w, seed + 2)) * gust;
+    }
+};
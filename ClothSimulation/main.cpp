@@ -6,7 +6,11 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <iostream>
+#include <chrono>
 #include <cmath>
+#include <new>
+#include <thread>
+#include <type_traits>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "Headers/stb_image.h"
@@ -14,17 +18,44 @@
 #include "Headers/Rigid.h"
 #include "Headers/Program.h"
 #include "Headers/Display.h"
+#include "Headers/Trace.h"
+#include "Headers/Simulation.h"
+#include "Headers/Multires.h"
+#include "Headers/Benchmark.h"
+#include "Headers/Golden.h"
+#include "Headers/Governor.h"
+#include "Headers/FixedStep.h"
+#include "Headers/Export.h"
+#include "Headers/Offscreen.h"
+
+/** Explicit instantiations: both precisions are compiled in every build **/
+template struct Vec2T<float>;
+template struct Vec2T<double>;
+template struct Vec3T<float>;
+template struct Vec3T<double>;
+template class NodeT<float>;
+template class NodeT<double>;
+template class SpringT<float>;
+template class SpringT<double>;
+template class ClothT<float>;
+template class ClothT<double>;
+template struct SimulationT<float>;
+template struct SimulationT<double>;
+template struct MultiresClothT<float>;
+template struct MultiresClothT<double>;
+template struct ClothEnsembleT<float>;
+template struct ClothEnsembleT<double>;
 
 #define WIDTH 800
 #define HEIGHT 800
 
-#define AIR_FRICTION 0.02
 #define TIME_STEP 0.01
 
 /** Executing Flow **/
 int running = 1;
 
 /** Functions **/
+void prepareScene(int argc, const char* argv[]);
 void processInput(GLFWwindow *window);
 
 /** Callback functions **/
@@ -38,11 +69,10 @@ int windBlowing = 0;
 int windForceScale = 15;
 Vec3 windStartPos;
 Vec3 windDir;
-Vec3 wind;
-// Cloth
+// Cloth, built in main() once the thread pool is sized
 Vec3 clothPos(-3, 7.5, -2);
 Vec2 clothSize(6, 6);
-Cloth cloth(clothPos, clothSize);
+Cloth* cloth = NULL;
 // Ground
 Vec3 groundPos(-5, 1.5, 0);
 Vec2 groundSize(10, 10);
@@ -56,10 +86,45 @@ Ball ball(ballPos, ballRadius, ballColor);
 // Window and world
 GLFWwindow *window;
 Vec3 bgColor = Vec3(50.0/255, 50.0/255, 60.0/255);
-Vec3 gravity(0.0, -9.8 / cloth.iterationFreq, 0.0);
+// Simulation
+Simulation* simulation = NULL;
 
 int main(int argc, const char * argv[])
 {
+    /** Headless kernel benchmarks **/
+    BenchmarkSuite benchmarks;
+    if (benchmarks.parseArgs(argc, argv)) {
+        return benchmarks.run();
+    }
+    /** Headless accuracy check of optimized backends **/
+    GoldenHarness golden;
+    if (golden.parseArgs(argc, argv)) {
+        return golden.run();
+    }
+    /** --threads=4: threads of the pool, the caller included, one per core by default; the scene is built on it **/
+    int threads = (int)std::thread::hardware_concurrency();
+    for (int i = 1; i < argc; i ++) { sscanf(argv[i], "--threads=%d", &threads); }
+    threadPool.resize(std::max(1, threads));
+    std::chrono::steady_clock::time_point buildStart = std::chrono::steady_clock::now();
+    Cloth sceneCloth(clothPos, clothSize);
+    Simulation sceneSimulation(&sceneCloth, &ground, &ball, TIME_STEP);
+    cloth = &sceneCloth;
+    simulation = &sceneSimulation;
+    LOG_INFO("Scene built on %d threads in %.1f ms\n", threadPool.size(),
+             std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count());
+    
+    /** --export_mesh, --export_trajectory: written by a pool of threads, see ExportQueue for the policies **/
+    ExportQueue exports;
+    exports.parseArgs(argc, argv);
+    ClothExporter exporter(&exports);
+    if (!exporter.parseArgs(argc, argv)) return 1;
+    /** Headless rendering to an image sequence, no window or display **/
+    HeadlessRender headless;
+    if (headless.parseArgs(argc, argv)) {
+        prepareScene(argc, argv);
+        return headless.run(*simulation, exporter);
+    }
+    
     /** Prepare for rendering **/
     // Initialize GLFW
     glfwInit();
@@ -76,7 +141,7 @@ int main(int argc, const char * argv[])
     /** Create a GLFW window **/
     window = glfwCreateWindow(WIDTH, HEIGHT, "Cloth Simulation", NULL, NULL);
     if (window == NULL) {
-        std::cout << "Failed to create GLFW window." << std::endl;
+        LOG_ERROR("Failed to create GLFW window.\n");
         glfwTerminate();
         return -1;
     }
@@ -85,7 +150,7 @@ int main(int argc, const char * argv[])
     
     // Initialize GLAD : this should be done before using any openGL function
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
-        std::cout << "Failed to initialize GLAD." << std::endl;
+        LOG_ERROR("Failed to initialize GLAD.\n");
         glfwTerminate(); // This line isn't in the official source code, but I think that it should be added here.
         return -1;
     }
@@ -96,20 +161,43 @@ int main(int argc, const char * argv[])
     glfwSetMouseButtonCallback(window, mouse_button_callback);
     glfwSetCursorPosCallback(window, cursor_pos_callback);
     
-    /** Renderers **/
-    ClothRender clothRender(&cloth);
-    ClothSpringRender clothSpringRender(&cloth);
+    prepareScene(argc, argv);
+    
+    /** --detail: draw a 4x denser cloth subdivided from the simulated one, --detail_physics simulates it near the ball **/
+    // Built in place: its fine simulation holds cache-line aligned queue members, which a plain new ignores before C++17
+    static std::aligned_storage<sizeof(MultiresCloth), alignof(MultiresCloth)>::type detailStorage;
+    MultiresCloth* detail = NULL;
+    for (int i = 1; i < argc; i ++) {
+        bool physics = strcmp(argv[i], "--detail_physics") == 0;
+        if (strcmp(argv[i], "--detail") != 0 && !physics) continue;
+        if (!detail) detail = new (&detailStorage) MultiresCloth(simulation, 4, Cloth::ORDER_HILBERT);
+        if (physics) detail->detailPhysics = true;
+    }
+    
+    /** --frame_budget=16.7: lower the quality while simulating and drawing a frame takes longer **/
+    FrameGovernor governor;
+    governor.parseArgs(argc, argv);
+    governor.detailPhysics = detail && detail->detailPhysics;
+    
+    /** --tick_rate=60: simulation frames per second of wall-clock time, whatever the display refresh rate **/
+    FixedStep fixedStep;
+    fixedStep.parseArgs(argc, argv);
+    
+    /** Renderers, for the detail cloth and the simulated one **/
+    ClothRender clothRender(cloth);
+    ClothSpringRender clothSpringRender(cloth);
+    ClothRender* detailRender = detail ? new ClothRender(&detail->fine) : NULL;
+    ClothSpringRender* detailSpringRender = detail ? new ClothSpringRender(&detail->fine) : NULL;
     GroundRender groundRender(&ground);
     BallRender ballRender(&ball);
     
-    Vec3 initForce(10.0, 40.0, 20.0);
-    cloth.addForce(initForce);
-    
     glEnable(GL_DEPTH_TEST);
     glPointSize(3);
     
     /** Redering loop **/
     running = 1;
+    long long exportFrame = 0;
+    double lastTime = glfwGetTime();
     while (!glfwWindowShouldClose(window))
     {
         /** Check for events **/
@@ -121,23 +209,37 @@ int main(int argc, const char * argv[])
         
         /** -------------------------------- Simulation & Rendering -------------------------------- **/
         
-        if (running) {
-            for (int i = 0; i < cloth.iterationFreq; i ++) {
-                cloth.computeForce(TIME_STEP, gravity);
-                cloth.integrate(AIR_FRICTION, TIME_STEP);
-                cloth.collisionResponse(&ground, &ball);
+        governor.beginFrame();
+        bool showDetail = detail && governor.current().detail;
+        double now = glfwGetTime();
+        int ticks = fixedStep.advance(now - lastTime);
+        lastTime = now;
+        ClothRender* shownRender = showDetail ? detailRender : &clothRender;
+        if (detail) (showDetail ? &clothRender : detailRender)->previous.clear(); // Stale once it is shown again
+        for (int i = 0; i < ticks; i ++) {
+            if (i == ticks - 1 && fixedStep.enabled()) shownRender->keepPrevious();
+            simulation->frame(); // Drains the input, does nothing else while paused
+            if (showDetail && !simulation->paused) {
+                TRACE_ZONE("detail");
+                detail->update();
             }
-            cloth.computeNormal();
+            if (!simulation->paused) exporter.frame(*cloth, exportFrame ++);
         }
+        shownRender->alpha = (float)fixedStep.alpha;
+        governor.simulated();
+        if (detail) detail->fine.drawMode = cloth->drawMode;
         
         /** Display **/
-        if (cloth.drawMode == Cloth::DRAW_LINES) {
-            clothSpringRender.flush();
+        if (cloth->drawMode == Cloth::DRAW_LINES) {
+            TRACE_ZONE("clothSpringRender.flush");
+            showDetail ? detailSpringRender->flush() : clothSpringRender.flush();
         } else {
-            clothRender.flush();
+            TRACE_ZONE("clothRender.flush");
+            shownRender->flush();
         }
-        ballRender.flush();
-        groundRender.flush();
+        { TRACE_ZONE("ballRender.flush"); ballRender.flush(); }
+        { TRACE_ZONE("groundRender.flush"); groundRender.flush(); }
+        if (governor.rendered()) governor.apply(*simulation, detail);
         
         /** -------------------------------- Simulation & Rendering -------------------------------- **/
         
@@ -146,10 +248,68 @@ int main(int argc, const char * argv[])
     }
 
     glfwTerminate();
+    exporter.flush();
+    exports.finish();
+    delete detailRender;
+    delete detailSpringRender;
+    if (detail) detail->~MultiresCloth();
+    
+    /** Timing report **/
+    TRACE_EXPORT("trace.json");
+    TRACE_SUMMARY();
+    governor.printSummary();
+    exports.printSummary();
     
     return 0;
 }
 
+/** The scene both the window and headless rendering start from **/
+void prepareScene(int argc, const char* argv[])
+{
+    // Lay the nodes out along a Hilbert curve before anything indexes them
+    cloth->reorder(Cloth::ORDER_HILBERT);
+    
+    // --bending=isometric: the constant bending matrix of Bending.h instead of the bending springs
+    // --stretch=stvk|corotated: the triangle membrane of Membrane.h instead of the structural and shear springs
+    double bendingStiffness = cloth->isometricBendingCoef, bendingDamping = cloth->isometricBendingDamp;
+    double young = cloth->membraneYoung, poisson = cloth->membranePoisson, membraneDamping = cloth->membraneDamp;
+    bool isometric = false;
+    Cloth::StretchModelEnum stretch = Cloth::STRETCH_SPRINGS;
+    for (int i = 1; i < argc; i ++) {
+        if (strcmp(argv[i], "--bending=isometric") == 0) isometric = true;
+        if (strcmp(argv[i], "--stretch=stvk") == 0) stretch = Cloth::STRETCH_STVK;
+        if (strcmp(argv[i], "--stretch=corotated") == 0) stretch = Cloth::STRETCH_COROTATED;
+        sscanf(argv[i], "--bending_stiffness=%lf", &bendingStiffness);
+        sscanf(argv[i], "--bending_damping=%lf", &bendingDamping);
+        sscanf(argv[i], "--membrane_young=%lf", &young);
+        sscanf(argv[i], "--membrane_poisson=%lf", &poisson);
+        sscanf(argv[i], "--membrane_damping=%lf", &membraneDamping);
+    }
+    // --lra=1.0: no node farther from its nearest pin than that times its distance along the cloth
+    for (int i = 1; i < argc; i ++) {
+        double limit;
+        if (sscanf(argv[i], "--lra=%lf", &limit) == 1) cloth->useLongRangeAttachments(limit);
+    }
+    if (isometric) cloth->useIsometricBending(bendingStiffness, bendingDamping);
+    cloth->useMembrane(stretch, young, poisson, membraneDamping);
+    if (isometric || stretch != Cloth::STRETCH_SPRINGS) simulation->estimateStability();
+    
+    // --adaptive: as few substeps per frame as stability and node speeds allow, see Simulation::chooseSubsteps
+    // --sleeping: resting tiles skip forces, integration and normals, see Cloth::updateSleep
+    // --aero: drag and lift per face against a gusty wind field instead of a uniform push
+    for (int i = 1; i < argc; i ++) {
+        if (strcmp(argv[i], "--adaptive") == 0) simulation->adaptive = true;
+        if (strcmp(argv[i], "--sleeping") == 0) simulation->sleeping = true;
+        if (strcmp(argv[i], "--aero") == 0) {
+            simulation->aerodynamics = true;
+            simulation->windField.gust = 2.0;
+        }
+    }
+    
+    Vec3 initForce(10.0, 40.0, 20.0);
+    simulation->commands.push(SimCommand::make(SimCommand::FORCE_IMPULSE, initForce));
+}
+
 void framebuffer_size_callback(GLFWwindow *window, int width, int height)
 {
     glViewport(0, 0, width, height);
@@ -169,6 +329,7 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
     {
         windBlowing = 0;
         windDir.setZeroVec();
+        simulation->commands.push(SimCommand::make(SimCommand::SET_WIND, Vec3()));
     }
 }
 
@@ -178,8 +339,7 @@ void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
     if (windBlowing && running) {
         windDir = Vec3(xpos, -ypos, 0) - windStartPos;
         windDir.normalize();
-        wind = windDir * windForceScale;
-        cloth.addForce(wind);
+        simulation->commands.push(SimCommand::make(SimCommand::SET_WIND, windDir * windForceScale));
     }
 }
 
@@ -192,13 +352,13 @@ void processInput(GLFWwindow *window)
     
     /** Set draw mode **/
     if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS) {
-        cloth.drawMode = Cloth::DRAW_NODES;
+        cloth->drawMode = Cloth::DRAW_NODES;
     }
     if (glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS) {
-        cloth.drawMode = Cloth::DRAW_LINES;
+        cloth->drawMode = Cloth::DRAW_LINES;
     }
     if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) {
-        cloth.drawMode = Cloth::DRAW_FACES;
+        cloth->drawMode = Cloth::DRAW_FACES;
     }
     
     /** Camera control : [W] [S] [A] [D] [Q] [E] **/
@@ -224,32 +384,54 @@ void processInput(GLFWwindow *window)
     /** Pause simulation **/
     if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS) {
         running = 0;
-        printf("Paused.\n");
+        simulation->commands.push(SimCommand::make(SimCommand::PAUSE));
+        LOG_INFO("Paused.\n");
     }
     if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
         running = 1;
-        printf("Running..\n");
+        simulation->commands.push(SimCommand::make(SimCommand::RESUME));
+        LOG_INFO("Running..\n");
+    }
+    
+    /** Substep control **/
+    if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS && simulation->adaptive) {
+        simulation->adaptive = false;
+        LOG_INFO("Fixed substeps.\n");
+    }
+    if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS && !simulation->adaptive) {
+        simulation->adaptive = true;
+        LOG_INFO("Adaptive substeps.\n");
+    }
+    
+    /** Tearing **/
+    if (glfwGetKey(window, GLFW_KEY_Y) == GLFW_PRESS && cloth->tearStretch == 0.0) {
+        simulation->commands.push(SimCommand::make(SimCommand::SET_TEARING, Vec3(2.5, 0.0, 0.0)));
+        LOG_INFO("Tearing on.\n");
+    }
+    if (glfwGetKey(window, GLFW_KEY_U) == GLFW_PRESS && cloth->tearStretch != 0.0) {
+        simulation->commands.push(SimCommand::make(SimCommand::SET_TEARING));
+        LOG_INFO("Tearing off.\n");
     }
     
     /** Drop the cloth **/
     if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS && running) {
-        cloth.unPin(cloth.pin1);
+        simulation->commands.push(SimCommand::make(SimCommand::UNPIN, Vec3(), cloth->pin1));
     }
     if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS && running) {
-        cloth.unPin(cloth.pin2);
+        simulation->commands.push(SimCommand::make(SimCommand::UNPIN, Vec3(), cloth->pin2));
     }
     
     /** Pull cloth **/
     if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS && running) {
-        cloth.addForce(Vec3(0.0, 0.0, -windForceScale));
+        simulation->commands.push(SimCommand::make(SimCommand::FORCE_IMPULSE, Vec3(0.0, 0.0, -windForceScale)));
     }
     if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS && running) {
-        cloth.addForce(Vec3(0.0, 0.0, windForceScale));
+        simulation->commands.push(SimCommand::make(SimCommand::FORCE_IMPULSE, Vec3(0.0, 0.0, windForceScale)));
     }
     if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS && running) {
-        cloth.addForce(Vec3(-windForceScale, 0.0, 0.0));
+        simulation->commands.push(SimCommand::make(SimCommand::FORCE_IMPULSE, Vec3(-windForceScale, 0.0, 0.0)));
     }
     if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS && running) {
-        cloth.addForce(Vec3(windForceScale, 0.0, 0.0));
+        simulation->commands.push(SimCommand::make(SimCommand::FORCE_IMPULSE, Vec3(windForceScale, 0.0, 0.0)));
     }
 }